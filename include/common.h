@@ -1,6 +1,8 @@
 #ifndef __PROCESS_COMMON_H__
 #define __PROCESS_COMMON_H__
 
+#include <string>
+
 #include "RayTrace.h"
 
 // Describes a region of the image
@@ -25,11 +27,231 @@ typedef struct {
     float* pixels;
 } RenderRegion;
 
+// Partitioning modes implemented by this program rather than the library.
+// They continue the PartType values declared in RayTrace.h.
+#define PART_MODE_WORK_STEALING ((PartType)64)
+#define PART_MODE_STATIC_COST_BLOCKS ((PartType)128)
+#define PART_MODE_DYNAMIC_HIERARCHICAL ((PartType)256)
+
+// Number of passes of progressive rendering. The first renders every
+// (1 << (PROGRESSIVE_PASSES - 1))th pixel across and down, and each pass
+// after halves the spacing, so the passes render 1/16, 1/4 and then all
+// of the image between them.
+#define PROGRESSIVE_PASSES 3
+
+// Formats that pixels can be sent between processes in
+typedef enum {
+    // 32-bit float per channel, as rendered
+    WIRE_FORMAT_FLOAT,
+
+    // 16-bit half float per channel, keeps values above 1
+    WIRE_FORMAT_HALF,
+
+    // 8 bits per channel, as saved to the PNG
+    WIRE_FORMAT_BYTE
+} WireFormat;
+
+// Orders that the tiles of dynamic partitioning can be handed out in
+typedef enum {
+    // Left to right, top to bottom
+    TILE_ORDER_RASTER,
+
+    // Along a Morton (Z order) curve
+    TILE_ORDER_MORTON,
+
+    // Along a Hilbert curve
+    TILE_ORDER_HILBERT
+} TileOrder;
+
+// Tone reproduction operators that the image can be mapped with before it
+// is quantized
+typedef enum {
+    // Channels above 1 are clipped
+    TONE_MAP_NONE,
+
+    // Reinhard et al.'s photographic operator, keyed to the log-average
+    // luminance, with the brightest pixel mapped to white
+    TONE_MAP_REINHARD,
+
+    // Ward's contrast based scale factor
+    TONE_MAP_WARD
+} ToneMap;
+
+// Options handled by this program rather than by the ray tracing library.
+// They are removed from the arguments before initialize() sees them.
+typedef struct {
+    // Number of rendering threads per process
+    int threads;
+
+    // Partitioning mode chosen with -p that the library does not know
+    // about, or PART_MODE_NONE to keep the mode set by the library
+    PartType partitioningMode;
+
+    // Number of tiles each worker may have outstanding in dynamic mode
+    int dynamicWindow;
+
+    // Print additional statistics after the standard timing output
+    bool stats;
+
+    // Directory to cache cost maps in, or NULL to not cache them
+    const char* costCacheDirectory;
+
+    // Scene configuration file given with -c
+    const char* configFile;
+
+    // Write the image to the PNG as rows are completed instead of holding
+    // all of it until the end
+    bool streamOutput;
+
+    // Format that dynamic mode tiles are sent to the master in
+    WireFormat wireFormat;
+
+    // Order that dynamic mode and work stealing hand out tiles in
+    TileOrder tileOrder;
+
+    // Give each dynamic mode worker its own contiguous run of tiles
+    bool tileAffinity;
+
+    // Hand out dynamic mode tiles in packets that shrink as the work left
+    // drops, rather than one tile at a time
+    bool guided;
+
+    // Node-local directory that rank 0 sends the scene files to, for every
+    // rank to load the scene from, or NULL to load it from where it is
+    const char* sceneDirectory;
+
+    // Ranks in each group under a sub-master in hierarchical dynamic mode,
+    // or 0 for one group per node
+    int hierarchyGroupSize;
+
+    // Render the static strips, blocks and cycles modes into an image
+    // shared by the ranks of each node
+    bool sharedImage;
+
+    // Render dynamic mode in coarse to fine passes, saving a preview of the
+    // image after each pass but the last
+    bool progressive;
+
+    // Operator to tone map the static modes with
+    ToneMap toneMap;
+
+    // Set if -help was given
+    bool help;
+} RenderOptions;
+
+// Options for this process, filled in by parseRenderOptions()
+extern RenderOptions renderOptions;
+
+/*
+ * Parses and removes the options in RenderOptions from the arguments
+ * @param argc Pointer to the number of arguments
+ * @param argv Pointer to the arguments
+ * @param options Filled in with the parsed options
+ * @return true if there was an error in the processing; otherwise, false
+ */
+bool parseRenderOptions(int* argc, char** argv[], RenderOptions* options);
+
+/*
+ * Points the -c argument, and the one the thread scene copies are loaded
+ * with, at another configuration file. Must be called before initialize().
+ * @param argc Number of arguments left by parseRenderOptions()
+ * @param argv Arguments left by parseRenderOptions()
+ * @param configFile Configuration file to load the scene from instead
+ */
+void setSceneConfigFile(int argc, char* argv[], const std::string& configFile);
+
+/*
+ * Applies the parsed options to the scene information. Must be called
+ * after initialize().
+ * @param data Scene information filled in by initialize()
+ */
+void applyRenderOptions(ConfigData* data);
+
+/*
+ * Prints a notice for each option given to raytrace_seq that only the MPI
+ * modes use
+ */
+void printSequentialIgnoredOptions();
+
+/*
+ * Prints the usage of the options in RenderOptions
+ */
+void printRenderOptionsHelp();
+
+/*
+ * Starts the rendering threads requested in renderOptions. Every thread
+ * other than the caller loads its own copy of the scene, since the
+ * library's scene objects keep per-ray state and cannot be shared.
+ *
+ * @param data Scene information of the calling thread
+ * @return true if a scene copy could not be loaded; otherwise, false
+ */
+bool startRenderThreads(ConfigData* data);
+
+/*
+ * Stops the rendering threads and frees their scene copies
+ */
+void stopRenderThreads();
+
+/*
+ * Gets the scene to render with from a thread pool tile function
+ * @param data Scene information of the thread that started the tiles
+ * @param thread Index of the thread, as passed to the tile function
+ * @return The scene information that thread may use
+ */
+ConfigData* getThreadScene(ConfigData* data, int thread);
+
+/*
+ * Gets the block of the image a rank renders in static blocks mode.
+ * The processes are laid out in a grid, with the number of columns and
+ * rows chosen from the factors of mpi_procs to keep the blocks as close to
+ * square as the image allows. Remainders are spread over the first rows
+ * and columns of the grid.
+ *
+ * @param data Scene information
+ * @param rank Rank to get the block of
+ * @param x Set to the x of the block in the image
+ * @param y Set to the y of the block in the image
+ * @param width Set to the width of the block
+ * @param height Set to the height of the block
+ */
+void getBlockBounds(ConfigData* data, int rank, int* x, int* y, int* width, int* height);
+
+/*
+ * Converts a channel of a pixel to 8 bits the same way savePixels() does
+ * @param value Channel of a rendered pixel
+ * @return Channel as it is saved to the PNG
+ */
+unsigned char quantizeChannel(float value);
+
 /*
  * Generic function which renders a region of the image
+ * Regions larger than a single tile are split into tiles and rendered by
+ * the thread pool when more than one thread was requested.
+ *
  * @param data Supplies scene information
  * @param region Supplies region information
  */
 void renderRegion(ConfigData* data, RenderRegion* region);
 
+/*
+ * Gets the progressive pass that first renders a pixel
+ * @param x X of the pixel in the image
+ * @param y Y of the pixel in the image
+ * @return Pass, from 0 to PROGRESSIVE_PASSES - 1
+ */
+int getPixelPass(int x, int y);
+
+/*
+ * Renders only the pixels of a region that are first rendered in the
+ * given progressive pass, leaving the others in pixels untouched. Every
+ * pixel is rendered by exactly one pass, so earlier passes are never
+ * rendered again.
+ *
+ * @param data Supplies scene information
+ * @param region Supplies region information
+ * @param pass Progressive pass to render
+ */
+void renderRegionPass(ConfigData* data, RenderRegion* region, int pass);
+
 #endif
@@ -0,0 +1,52 @@
+#ifndef __COST_MODEL_H__
+#define __COST_MODEL_H__
+
+#include "RayTrace.h"
+
+// Estimated cost of rendering each part of the image
+typedef struct {
+    // Pixels between samples in each direction; each sample stands for a
+    // stride x stride cell of the image
+    int stride;
+
+    // Number of cells in each direction
+    int cellsAcross;
+    int cellsDown;
+
+    // Seconds to shade the sampled pixel of each cell, in raster order
+    double* costs;
+} CostMap;
+
+/*
+ * Builds the cost map of the image. Every process must call this.
+ * The map is read from the cost cache directory when one for the same
+ * image size and the same contents of the scene's files is there.
+ * Otherwise each process times the shading of every
+ * mpi_procs'th sample, the timings are combined on every process, and
+ * rank 0 saves the map to the cost cache directory, if one was given.
+ *
+ * @param data Scene information
+ * @param map Filled in with the cost map; free with freeCostMap()
+ * @return Time this process spent shading samples
+ */
+double buildCostMap(ConfigData* data, CostMap* map);
+
+/*
+ * Frees the costs of a cost map
+ * @param map Cost map from buildCostMap()
+ */
+void freeCostMap(CostMap* map);
+
+/*
+ * Splits the image into one rectangle per process with roughly equal
+ * estimated cost, by recursive bisection of the longer side.
+ * Gives the same result on every process for the same map.
+ *
+ * @param data Scene information
+ * @param map Cost map of the image
+ * @param rects Filled in with x, y, width, height of each process's
+ *     rectangle; 4 * mpi_procs ints
+ */
+void partitionByCost(ConfigData* data, CostMap* map, int* rects);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __HIERARCHY_H__
+#define __HIERARCHY_H__
+
+#include <mpi.h>
+
+#include "RayTrace.h"
+
+// Communicators of hierarchical dynamic mode
+typedef struct {
+    // Rank 0 followed by every sub-master
+    MPI_Comm leaders;
+
+    // A sub-master followed by its workers, all on one node; MPI_COMM_NULL
+    // on rank 0, which belongs to no group
+    MPI_Comm group;
+} DynamicHierarchy;
+
+/*
+ * Splits the processes into groups for hierarchical dynamic mode. Each
+ * node's ranks, other than rank 0, are split into groups of -hg ranks, or
+ * one group if -hg was not given. The lowest rank of each group is its
+ * sub-master. Every process must call this.
+ *
+ * @param data Scene information
+ * @param hierarchy Filled in with the communicators; free them with
+ *     freeDynamicHierarchy()
+ */
+void splitDynamicHierarchy(ConfigData* data, DynamicHierarchy* hierarchy);
+
+/*
+ * Frees the communicators of splitDynamicHierarchy()
+ * @param hierarchy Communicators to free
+ */
+void freeDynamicHierarchy(DynamicHierarchy* hierarchy);
+
+/*
+ * Runs a sub-master. Chunks from rank 0 are split into -bw by -bh tiles
+ * and handed out to the group's workers, up to -wd tiles per worker at a
+ * time. Each chunk goes back to rank 0 in one message once all of its tiles
+ * are in. A sub-master without workers renders its chunks itself.
+ *
+ * @param data Scene information
+ * @param hierarchy Communicators from splitDynamicHierarchy()
+ * @return Number of messages exchanged with the workers
+ */
+long long runSubMaster(ConfigData* data, DynamicHierarchy* hierarchy);
+
+#endif
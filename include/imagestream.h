@@ -0,0 +1,78 @@
+#ifndef __IMAGE_STREAM_H__
+#define __IMAGE_STREAM_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <png.h>
+
+#include "RayTrace.h"
+
+// PNG being written a row at a time, as the tiles covering each row come in.
+// Only rows that have started to arrive and are not yet written are held,
+// already converted to 8 bits per channel.
+typedef struct {
+    FILE* file;
+    std::string path;
+    png_structp png;
+    png_infop info;
+
+    int width;
+    int height;
+
+    // Next row to write to the PNG
+    int nextRow;
+
+    // Each row not yet written, or NULL if nothing has arrived for it
+    std::vector<unsigned char*> rows;
+
+    // Number of pixels not yet arrived in each row
+    std::vector<int> missingPixels;
+
+    // Rows currently held, and the most held at once
+    int heldRows;
+    int peakHeldRows;
+
+    // Time spent converting and encoding pixels
+    double encodeTime;
+
+    // Set once libpng has failed; the rest of the image is thrown away
+    bool failed;
+} ImageStream;
+
+/*
+ * Opens a PNG to stream the image into
+ *
+ * @param stream Stream to open
+ * @param file Path of the PNG
+ * @param data Scene information
+ * @return true if the file could not be opened; otherwise, false
+ */
+bool openImageStream(ImageStream* stream, std::string file, ConfigData* data);
+
+/*
+ * Adds a block of rendered pixels to the image. Every row that is complete
+ * once they are added, and that has no incomplete row above it, is
+ * written to the PNG and released.
+ *
+ * @param stream Stream opened with openImageStream()
+ * @param pixels Pixels of the block, packed at the width of the block
+ * @param x X of the block in the image
+ * @param y Y of the block in the image
+ * @param width Width of the block
+ * @param height Height of the block
+ * @return true if the PNG could not be written, now or earlier; otherwise,
+ *     false
+ */
+bool streamPixels(ImageStream* stream, float* pixels, int x, int y, int width, int height);
+
+/*
+ * Finishes the PNG and closes it. Every pixel must have been streamed;
+ * if any are missing, or the PNG could not be written, the partial file
+ * is removed.
+ * @param stream Stream opened with openImageStream()
+ * @return true if the PNG could not be written; otherwise, false
+ */
+bool closeImageStream(ImageStream* stream);
+
+#endif
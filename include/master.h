@@ -2,6 +2,9 @@
 #define __MASTER_PROCESS_H__
 
 #include "RayTrace.h"
+#include "imagestream.h"
+#include "sharedimage.h"
+#include "tileorder.h"
 
 //This function is the main that only the master process
 //will run.
@@ -30,6 +33,15 @@ void masterSequential(ConfigData *data, float* pixels);
  */
 void masterStaticContinuousColumns(ConfigData* data, float* pixels);
 
+/*
+ * Static partitioning - contiguous strips of rows
+ * Renders a strip of rows corresponding to our rank
+ * 
+ * @param data Scene information
+ * @param pixels Buffer for rendered image
+ */
+void masterStaticContinuousRows(ConfigData* data, float* pixels);
+
 /*
  * Static partitioning - square blocks
  * Renders a square in the image corresponding to our rank
@@ -48,21 +60,85 @@ void masterStaticSquareBlocks(ConfigData* data, float* pixels);
  */
 void masterStaticCyclicalRows(ConfigData* data, float* pixels);
 
+/*
+ * Static partitioning - cyclical columns
+ * Renders strips of n contiguous columns, as many are needed
+ * 
+ * @param data Scene information
+ * @param pixels Buffer for rendered image
+ */
+void masterStaticCyclicalColumns(ConfigData* data, float* pixels);
+
 /*
  * Dynamic partitioning - centralized queue
  * Recieves work units from a central queue.
  * 
  * @param data Scene information
+ * @param pixels Buffer for rendered image, unused when streaming
+ * @param stream Stream to write tiles to as they come in, or NULL to
+ *     recieve them into pixels
+ * @param file Path the image is saved to, which progressive previews are
+ *     named after
+ */
+void masterDynamicCentralizedQueue(ConfigData* data, float* pixels, ImageStream* stream, std::string file);
+
+/*
+ * Dynamic partitioning - hierarchical queue
+ * Hands out chunks of tiles to a sub-master for each node, which hands
+ * out the tiles to the other ranks of its node and sends back each chunk
+ * once it is complete.
+ * 
+ * @param data Scene information
+ * @param pixels Buffer for rendered image, unused when streaming
+ * @param stream Stream to write chunks to as they come in, or NULL to
+ *     recieve them into pixels
+ */
+void masterDynamicHierarchical(ConfigData* data, float* pixels, ImageStream* stream);
+
+/*
+ * Static partitioning - shared image
+ * Renders our part of any of the strips, blocks or cycles modes into an
+ * image shared by our node, which the rest of the node renders into too,
+ * then recieves the parts of every other node. The image is left open so
+ * it can be saved straight from shared memory; close it afterwards with
+ * closeSharedImage().
+ * 
+ * @param data Scene information
+ * @param image Filled in with the shared image, holding the whole image
+ */
+void masterStaticSharedImage(ConfigData* data, SharedImage* image);
+
+/*
+ * Static partitioning - cost balanced blocks
+ * Estimates the cost of the image with a coarse pre-pass, then renders
+ * the block of roughly equal cost corresponding to our rank
+ * 
+ * @param data Scene information
+ * @param pixels Buffer for rendered image
+ */
+void masterStaticCostBlocks(ConfigData* data, float* pixels);
+
+/*
+ * Distributed work stealing
+ * Renders tiles alongside the slaves, stealing from them when out of
+ * tiles, then gathers the tiles that the slaves rendered.
+ * 
+ * @param data Scene information
  * @param pixels Buffer for rendered image
  */
-void masterDynamicCentralizedQueue(ConfigData* data, float* pixels);
+void masterDistributedWorkStealing(ConfigData* data, float* pixels);
 
 /**
- * Increments the work packet for dynamic partitioning
+ * Sets the work packet for dynamic partitioning to the next tiles for a
+ * worker, as x y width height, or to -1 -1 -1 -1 once every tile has been
+ * handed out
  * 
  * @param data Scene information
+ * @param sequence Tiles in the order they are handed out
+ * @param worker Index of the worker the work packet is for
+ * @param tiles Most tiles to put in the work packet
  * @param workPacket work packet
  */
-void incrementWorkPacket(ConfigData* data, int* workPacket);
+void nextWorkPacket(ConfigData* data, TileSequence* sequence, int worker, int tiles, int* workPacket);
 
 #endif
@@ -0,0 +1,66 @@
+#ifndef __PROGRESSIVE_H__
+#define __PROGRESSIVE_H__
+
+#include "RayTrace.h"
+
+/*
+ * Checks whether dynamic mode should render in progressive passes. Only
+ * dynamic partitioning can, and only without -stream, since the previews
+ * need the whole image.
+ *
+ * @param data Scene information
+ * @return true if rendering progressively; otherwise, false
+ */
+bool usesProgressive(ConfigData* data);
+
+/*
+ * Counts the pixels of a region first rendered in a pass
+ *
+ * @param x X of the region in the image
+ * @param y Y of the region in the image
+ * @param width Width of the region
+ * @param height Height of the region
+ * @param pass Progressive pass
+ * @return Number of pixels
+ */
+int countPassPixels(int x, int y, int width, int height, int pass);
+
+/*
+ * Packs the pixels of a pass together, in raster order, in place
+ *
+ * @param pixels Pixels of the region, packed at its width
+ * @param x X of the region in the image
+ * @param y Y of the region in the image
+ * @param width Width of the region
+ * @param height Height of the region
+ * @param pass Progressive pass
+ */
+void packPassPixels(float* pixels, int x, int y, int width, int height, int pass);
+
+/*
+ * Puts pixels packed by packPassPixels() back in their places in the image
+ *
+ * @param data Scene information
+ * @param packed Pixels of the pass
+ * @param x X of the region in the image
+ * @param y Y of the region in the image
+ * @param width Width of the region
+ * @param height Height of the region
+ * @param pass Progressive pass
+ * @param image Image to place the pixels in
+ */
+void unpackPassPixels(ConfigData* data, float* packed, int x, int y, int width, int height, int pass, float* image);
+
+/*
+ * Fills in a preview of the image once a pass is complete. Each pixel not
+ * rendered yet takes the colour of the rendered pixel above and to the
+ * left of it on the grid of that pass.
+ *
+ * @param data Scene information
+ * @param image Image rendered up to and including the pass
+ * @param pass Progressive pass just completed
+ * @param preview Filled in with the preview, the size of the image
+ */
+void fillPreview(ConfigData* data, float* image, int pass, float* preview);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __SCENE_FILES_H__
+#define __SCENE_FILES_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Lists the files a scene is read from: the configuration file, every
+ * model named by a <Path> in it, and the material libraries those models
+ * use. Files that cannot be opened are still listed, since initialize()
+ * reports them itself.
+ *
+ * @param configFile Scene configuration file given with -c
+ * @param files Filled in with the paths, the configuration file first
+ */
+void listSceneFiles(const char* configFile, std::vector<std::string>* files);
+
+/*
+ * Reads a whole file
+ * @param path Path of the file
+ * @param contents Filled in with the contents of the file
+ * @return true if the file could not be read; otherwise, false
+ */
+bool readSceneFile(const std::string& path, std::string* contents);
+
+/*
+ * Hashes the names and contents of the files of a scene, to tell whether
+ * anything derived from the scene is out of date. A missing file hashes
+ * differently from an empty one.
+ *
+ * @param files Paths from listSceneFiles()
+ * @return 64-bit FNV-1a hash
+ */
+uint64_t hashSceneFiles(const std::vector<std::string>& files);
+
+/*
+ * Copies the files of a scene to a node-local directory on every node.
+ * Only rank 0 reads them; it broadcasts them to one rank per node, which
+ * writes them under a subdirectory named by their hash, with the model
+ * paths in the configuration file pointed at the copies. Every process
+ * must call this, after MPI_Init().
+ *
+ * @param configFile Scene configuration file given with -c
+ * @param directory Node-local directory to copy the files to
+ * @param localConfigFile Set to the copy of the configuration file
+ * @param bytes Set to the total size of the scene's files
+ * @return true if the files could not be written on any node; otherwise,
+ *     false
+ */
+bool shareSceneFiles(const char* configFile, const char* directory, std::string* localConfigFile, long long* bytes);
+
+#endif
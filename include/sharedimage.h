@@ -0,0 +1,86 @@
+#ifndef __SHARED_IMAGE_H__
+#define __SHARED_IMAGE_H__
+
+#include <mpi.h>
+#include <vector>
+
+#include "RayTrace.h"
+
+// An image shared by the ranks of a node, for the static modes to render
+// straight into
+typedef struct {
+    // Ranks on this node, the lowest rank first
+    MPI_Comm node;
+
+    // Window holding the image, allocated by the lowest rank of the node
+    MPI_Win window;
+
+    // On the master's node, the whole image as laid out on the master.
+    // On every other node, packed: only the parts its ranks render, in
+    // rank order, each at its own width.
+    float* pixels;
+    bool packed;
+
+    // Lowest rank on the node of each rank, which sends the node's part of
+    // the image to the master
+    std::vector<int> leaders;
+} SharedImage;
+
+/*
+ * Checks whether the static modes should render into a shared image. Only
+ * the strips, blocks and cycles modes can, and only if -shm was given.
+ *
+ * @param data Scene information
+ * @return true if the image should be shared; otherwise, false
+ */
+bool usesSharedImage(ConfigData* data);
+
+/*
+ * Allocates the image shared by the ranks of each node, the whole image on
+ * the master's node and only the node's own parts elsewhere. Every process
+ * must call this.
+ *
+ * @param data Scene information
+ * @param image Filled in with the image; free it with closeSharedImage()
+ */
+void openSharedImage(ConfigData* data, SharedImage* image);
+
+/*
+ * Renders our part of the image in the current static mode straight into
+ * the shared image, at the same place the master would put it, or at its
+ * place among the node's packed parts
+ *
+ * @param data Scene information
+ * @param image Image from openSharedImage()
+ * @return Time spent rendering
+ */
+double renderSharedImage(ConfigData* data, SharedImage* image);
+
+/*
+ * Waits for every rank on the node to finish rendering, after which the
+ * whole node's part of the image can be read. Every process must call this.
+ *
+ * @param image Image from openSharedImage()
+ */
+void syncSharedImage(SharedImage* image);
+
+/*
+ * Creates a datatype for the parts of the image rendered by the ranks of
+ * a node. Send or recieve with it at the address of the image. A packed
+ * image sends its parts as they are, and the master recieves them into
+ * place.
+ *
+ * @param data Scene information
+ * @param image Image from openSharedImage()
+ * @param leader Lowest rank of the node
+ * @return Committed datatype
+ */
+MPI_Datatype createNodeImageType(ConfigData* data, SharedImage* image, int leader);
+
+/*
+ * Frees the shared image. Every process must call this.
+ * @param image Image from openSharedImage()
+ */
+void closeSharedImage(SharedImage* image);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef __SLAVE_PROCESS_H__
 #define __SLAVE_PROCESS_H__
 
+#include <mpi.h>
+
 #include "RayTrace.h"
 
 void slaveMain( ConfigData *data );
@@ -13,6 +15,14 @@ void slaveMain( ConfigData *data );
  */
 void slaveStaticContinuousColumns(ConfigData* data);
 
+/*
+ * Static partitioning - contiguous strips of rows
+ * Renders a strip of rows corresponding to our rank
+ * 
+ * @param data Scene information
+ */
+void slaveStaticContinuousRows(ConfigData* data);
+
 /*
  * Static partitioning - square blocks
  * Renders a square in the image corresponding to our rank
@@ -29,12 +39,60 @@ void slaveStaticSquareBlocks(ConfigData* data);
  */
 void slaveStaticCyclicalRows(ConfigData* data);
 
+/*
+ * Static partitioning - cyclical columns
+ * Renders strips of n contiguous columns, as many are needed
+ * 
+ * @param data Scene information
+ */
+void slaveStaticCyclicalColumns(ConfigData* data);
+
+/*
+ * Static partitioning - shared image
+ * Renders our part of any of the strips, blocks or cycles modes into an
+ * image shared by our node. The lowest rank of the node sends the node's
+ * part to the master, unless the master is on our node.
+ * 
+ * @param data Scene information
+ */
+void slaveStaticSharedImage(ConfigData* data);
+
+/*
+ * Static partitioning - cost balanced blocks
+ * Estimates the cost of the image with a coarse pre-pass, then renders
+ * the block of roughly equal cost corresponding to our rank
+ * 
+ * @param data Scene information
+ */
+void slaveStaticCostBlocks(ConfigData* data);
+
 /*
  * Dynamic partitioning - centralized queue
  * Recieves work units from a central queue.
  * 
  * @param data Scene information
+ * @param comm Communicator whose rank 0 runs the queue
+ * @param pass Progressive pass to render the tiles in, or -1 for every
+ *     pixel of them
+ */
+void slaveDynamicCentralizedQueue(ConfigData* data, MPI_Comm comm, int pass);
+
+/*
+ * Dynamic partitioning - hierarchical queue
+ * The first rank of each group runs a sub-master for the group, and the
+ * others work for it as in the centralized queue.
+ * 
+ * @param data Scene information
+ */
+void slaveDynamicHierarchical(ConfigData* data);
+
+/*
+ * Distributed work stealing
+ * Renders tiles, stealing from other processes when out of tiles, then
+ * sends every tile it rendered to the master.
+ * 
+ * @param data Scene information
  */
-void slaveDynamicCentralizedQueue(ConfigData* data);
+void slaveDistributedWorkStealing(ConfigData* data);
 
 #endif
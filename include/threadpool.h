@@ -0,0 +1,42 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+/*
+ * Function run by the pool for a single tile
+ * @param tile Index of the tile to process
+ * @param thread Index of the thread processing the tile, 0 is the caller
+ * @param arg User supplied argument
+ */
+typedef void (*TileFunction)(int tile, int thread, void* arg);
+
+/*
+ * Starts the rendering threads. The calling thread counts as one of them
+ * and takes part in every call to runTiles().
+ *
+ * @param threads Total number of threads, including the caller
+ */
+void startThreadPool(int threads);
+
+/*
+ * Stops and joins the rendering threads
+ */
+void stopThreadPool();
+
+/*
+ * Returns the total number of threads in the pool, including the caller
+ */
+int threadPoolSize();
+
+/*
+ * Runs a function over every tile in [0, tileCount) using the pool.
+ * Each thread starts with a contiguous slice of the tiles and steals from
+ * the back of other threads' queues once its own slice is exhausted.
+ * Returns once every tile has been processed.
+ *
+ * @param tileCount Number of tiles
+ * @param function Function to call for each tile
+ * @param arg Argument passed to every call of function
+ */
+void runTiles(int tileCount, TileFunction function, void* arg);
+
+#endif
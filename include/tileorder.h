@@ -0,0 +1,74 @@
+#ifndef __TILE_ORDER_H__
+#define __TILE_ORDER_H__
+
+#include <vector>
+
+#include "RayTrace.h"
+#include "common.h"
+
+// Order that the dynamic sized tiles are handed out in
+typedef struct {
+    // Index of every tile, in raster order of tiles, in the order they
+    // are handed out
+    std::vector<int> tiles;
+
+    // Each chunk of tiles not yet handed out, [next, end)
+    std::vector<int> next;
+    std::vector<int> end;
+
+    int tilesAcross;
+
+    // Set if the tiles are in raster order, so runs of them can be handed
+    // out together as one rectangle
+    bool raster;
+} TileSequence;
+
+/*
+ * Orders the tiles of the image along the requested curve. The tiles are
+ * split into contiguous chunks along it, one for each worker if tile
+ * affinity was requested, otherwise one shared by everyone.
+ *
+ * @param data Scene information
+ * @param order Curve to order the tiles along
+ * @param chunks Number of chunks to split the tiles into
+ * @param sequence Filled in with the tiles
+ */
+void buildTileSequence(ConfigData* data, TileOrder order, int chunks, TileSequence* sequence);
+
+/*
+ * Takes the next tiles of a worker's chunk. Once that chunk is empty, the
+ * tiles are taken from the back of the fullest chunk, so that its owner
+ * keeps the tiles next to the ones it already has. In raster order up to
+ * count tiles are taken at once, either as whole rows of tiles or as a
+ * run along one row, so they always form a rectangle; otherwise a single
+ * tile is taken.
+ *
+ * @param data Scene information
+ * @param sequence Sequence from buildTileSequence()
+ * @param worker Index of the worker the tiles are for
+ * @param count Most tiles to take
+ * @param x Set to the x of the tiles in the image
+ * @param y Set to the y of the tiles in the image
+ * @param width Set to the width of the tiles, clipped to the image
+ * @param height Set to the height of the tiles, clipped to the image
+ * @return true if tiles were taken, false if every tile was handed out
+ */
+bool takeTiles(ConfigData* data, TileSequence* sequence, int worker, int count, int* x, int* y, int* width, int* height);
+
+/*
+ * Counts the tiles not yet handed out
+ * @param sequence Sequence from buildTileSequence()
+ * @return Number of tiles
+ */
+int countRemainingTiles(TileSequence* sequence);
+
+/*
+ * Gets the most tiles that guided scheduling hands out at once, so both
+ * ends can size their buffers. This is 1 without guided scheduling.
+ *
+ * @param data Scene information
+ * @return Number of tiles
+ */
+int getMaxPacketTiles(ConfigData* data);
+
+#endif
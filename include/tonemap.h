@@ -0,0 +1,28 @@
+#ifndef __TONE_MAP_H__
+#define __TONE_MAP_H__
+
+#include "RayTrace.h"
+
+/*
+ * Checks whether the image should be tone mapped. Only the static modes
+ * that gather their results on rank 0 can, and only if -tm was given.
+ *
+ * @param data Scene information
+ * @return true if tone mapping; otherwise, false
+ */
+bool usesToneMapping(ConfigData* data);
+
+/*
+ * Tone maps the pixels a process rendered with the -tm operator, keyed
+ * to the luminance of the whole image, and quantizes them to 8 bits per
+ * channel the same way savePixels() does. Each process adds up the
+ * luminance of its own pixels, and one MPI_Allreduce combines them. Every
+ * process must call this once, with all of its pixels.
+ *
+ * @param pixels Pixels rendered by this process
+ * @param channels Number of channels, 3 per pixel
+ * @param quantized Buffer of channels bytes to fill
+ */
+void toneMapPixels(float* pixels, int channels, unsigned char* quantized);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef __WIRE_FORMAT_H__
+#define __WIRE_FORMAT_H__
+
+#include <mpi.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// Sent ahead of the pixels of every tile in dynamic mode
+typedef struct {
+    // Region of the image the tile covers; a width of 0 marks the last
+    // message from a worker, which has no pixels
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+
+    // Time spent rendering the tile
+    double computationTime;
+
+    // Time spent waiting since the previous tile was sent
+    double idleTime;
+} TileHeader;
+
+/*
+ * Creates the datatype of a TileHeader. Free it with MPI_Type_free().
+ * @return Committed datatype
+ */
+MPI_Datatype createTileHeaderType();
+
+/*
+ * Creates the datatype of a whole tile message: a header followed by its
+ * pixels, each wherever they are in memory. Send or recieve with it at
+ * MPI_BOTTOM, and free it with MPI_Type_free().
+ *
+ * @param headerType Datatype from createTileHeaderType()
+ * @param header Header of the tile
+ * @param pixelsType Datatype of the pixels of the tile
+ * @param pixels Pixels of the tile
+ * @return Committed datatype
+ */
+MPI_Datatype createTileMessageType(MPI_Datatype headerType, TileHeader* header, MPI_Datatype pixelsType, void* pixels);
+
+/*
+ * Gets the datatype of one channel of a pixel on the wire
+ * @param format Wire format
+ * @return Predefined datatype
+ */
+MPI_Datatype wireChannelType(WireFormat format);
+
+/*
+ * Gets the size of one channel of a pixel on the wire
+ * @param format Wire format
+ * @return Size in bytes
+ */
+int wireChannelSize(WireFormat format);
+
+/*
+ * Converts pixels to the wire format
+ *
+ * @param format Wire format
+ * @param pixels Pixels to convert
+ * @param channels Number of channels, 3 per pixel
+ * @param wire Buffer of channels * wireChannelSize() bytes to fill
+ */
+void encodePixels(WireFormat format, float* pixels, int channels, void* wire);
+
+/*
+ * Converts pixels from the wire format. Pixels sent as bytes come back as
+ * the middle of their 8-bit step, so saving them gives the same PNG as
+ * saving the originals.
+ *
+ * @param format Wire format
+ * @param wire Pixels on the wire
+ * @param channels Number of channels, 3 per pixel
+ * @param pixels Buffer of channels floats to fill
+ */
+void decodePixels(WireFormat format, void* wire, int channels, float* pixels);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __WORK_STEALING_H__
+#define __WORK_STEALING_H__
+
+#include <vector>
+
+#include "RayTrace.h"
+
+// Tiles rendered by one process in work stealing mode
+typedef struct {
+    // Index of each tile rendered into pixels, in raster order of tiles
+    std::vector<int> tiles;
+
+    // Pixels of each tile in the order of tiles, packed one after another
+    // at the size of the tile
+    std::vector<float> pixels;
+
+    // Time spent rendering
+    double computationTime;
+} StolenTiles;
+
+/*
+ * Distributed work stealing - every process renders
+ * Each process starts with a contiguous slice of the dynamic sized tiles.
+ * Once its slice runs out it steals half of the remaining tiles of a
+ * randomly chosen process, until rank 0 sees that every tile is done.
+ *
+ * @param data Scene information
+ * @param image Image to render into directly, or NULL to keep the tiles
+ *     in results
+ * @param results Tiles rendered by this process
+ */
+void renderWithWorkStealing(ConfigData* data, float* image, StolenTiles* results);
+
+/*
+ * Gets the region in the image covered by a tile in work stealing mode
+ *
+ * @param data Scene information
+ * @param tile Index of the tile
+ * @param x Set to the x of the tile in the image
+ * @param y Set to the y of the tile in the image
+ * @param width Set to the width of the tile, clipped to the image
+ * @param height Set to the height of the tile, clipped to the image
+ */
+void getStolenTileBounds(ConfigData* data, int tile, int* x, int* y, int* width, int* height);
+
+#endif
@@ -43,3 +43,5 @@
 # not be valid or you may have wasted resources that others could
 # have used.
 ./raytrace_seq -h 100 -w 100 -c configs/twhitted.xml -p none
+# Multithreaded reference render (add -c <threads> to the #SBATCH -p line above)
+# ./raytrace_seq -h 100 -w 100 -c configs/twhitted.xml -p none -t 4
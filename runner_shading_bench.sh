@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+
+# Measures how fast the library shades pixels on both scenes, to compare
+# builds of libraytrace.a against each other. Run it once per library
+# build on the same kind of node and compare the Pixels Shaded per Second
+# lines. Submit it the same way as runner_seq.sh; see there for what the
+# #SBATCH options mean.
+
+#SBATCH -J rt_shading_bench
+#SBATCH -o std/rt_shading_bench_%j.out
+#SBATCH -e std/rt_shading_bench_%j.err
+#SBATCH -p kgcoe-mps -n 1 -N 1
+#SBATCH --mem-per-cpu=2000M
+
+# One thread, so only the library's per-pixel cost is measured. Each
+# scene is rendered a few times since the first render also warms the
+# caches and the file system.
+for SCENE in twhitted box; do
+    for RUN in 1 2 3; do
+        echo "==== $SCENE, run $RUN ===="
+        ./raytrace_seq -h 500 -w 500 -c configs/$SCENE.xml -p none -stats
+    done
+done
@@ -0,0 +1,36 @@
+#!/bin/bash
+#
+
+# Benchmarks the tile orders of dynamic partitioning against each other.
+# Submit it the same way as runner_mpi.sh; see there for what the
+# #SBATCH options mean.
+
+#SBATCH -J rt_tile_order
+#SBATCH -o std/rt_tile_order_%j.out
+#SBATCH -e std/rt_tile_order_%j.err
+#SBATCH --partition=kgcoe-mps
+#SBATCH --account=kgcoe-mps
+#SBATCH --get-user-env
+#SBATCH --ntasks=16
+#SBATCH --time=0-1:0:0
+#SBATCH --mem=1000M
+
+spack env activate cmpe-655
+
+# Every order, with and without per-worker runs of tiles, on the complex
+# scene. Small tiles make the jumps between consecutive tiles matter most.
+# When perf is available each worker's cache misses are counted as well;
+# look for the cache-misses lines of each run in the output.
+ARGS="-h 1000 -w 1000 -c configs/box.xml -p dynamic -bw 8 -bh 8 -wd 2 -stats"
+
+PERF=""
+if command -v perf > /dev/null; then
+    PERF="perf stat -e cache-misses,cache-references,LLC-load-misses"
+fi
+
+for ORDER in raster morton hilbert; do
+    for AFFINITY in "" "-ta"; do
+        echo "==== -to $ORDER $AFFINITY ===="
+        srun -n $SLURM_NPROCS $PERF raytrace_mpi $ARGS -to $ORDER $AFFINITY
+    done
+done
@@ -1,9 +1,398 @@
 // Code common to both master and slave processes
 
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+
 #include "RayTrace.h"
 #include "common.h"
+#include "threadpool.h"
 
-void renderRegion(ConfigData* data, RenderRegion* region) {
+// Size of the square tiles that regions are split into for threading
+#define THREAD_TILE_SIZE 16
+
+RenderOptions renderOptions = { 1, PART_MODE_NONE, 1, false, NULL, NULL, false, WIRE_FORMAT_FLOAT, TILE_ORDER_RASTER, false, false, NULL, 0, false, false, TONE_MAP_NONE, false };
+
+// Partitioning modes that this program adds on top of the library's.
+// The library is given libraryName instead so it still checks the
+// parameters that the mode depends on.
+typedef struct {
+    const char* name;
+    const char* libraryName;
+    PartType mode;
+} ExtraPartMode;
+
+static const ExtraPartMode extraPartModes[] = {
+    { "work_stealing", "dynamic", PART_MODE_WORK_STEALING },
+    { "static_cost_blocks", "static_blocks", PART_MODE_STATIC_COST_BLOCKS },
+    { "dynamic_hierarchical", "dynamic", PART_MODE_DYNAMIC_HIERARCHICAL }
+};
+
+static const int extraPartModeCount = sizeof(extraPartModes) / sizeof(extraPartModes[0]);
+
+// Arguments left for the library, kept to load scene copies for threads
+static int sceneArgc = 0;
+static char** sceneArgv = NULL;
+
+// Configuration file set by setSceneConfigFile(), which -c points at
+static std::string sceneConfigFile;
+
+// Scene copy used by each pool thread. The library's meshes remember the
+// triangle they last hit, so one scene cannot be shared between threads.
+// Thread 0 is the caller and renders with the ConfigData it was given.
+static ConfigData* threadScenes = NULL;
+
+// Reads the integer value following argument i
+static bool parseIntOption(int argc, char* argv[], int i, int minimum, int* value) {
+    if(i + 1 >= argc) {
+        std::cout << "ERROR: " << argv[i] << " requires a value." << std::endl;
+        return true;
+    }
+
+    char* end;
+    long parsed = strtol(argv[i + 1], &end, 10);
+    if(*end != '\0' || parsed < minimum) {
+        std::cout << "ERROR: " << argv[i + 1] << " is not a valid value for " << argv[i] << "." << std::endl;
+        return true;
+    }
+
+    *value = (int)parsed;
+    return false;
+}
+
+// Reads the string value following argument i
+static bool parseStringOption(int argc, char* argv[], int i, const char** value) {
+    if(i + 1 >= argc) {
+        std::cout << "ERROR: " << argv[i] << " requires a value." << std::endl;
+        return true;
+    }
+
+    *value = argv[i + 1];
+    return false;
+}
+
+bool parseRenderOptions(int* argc, char** argv[], RenderOptions* options) {
+    char** args = *argv;
+    int kept = 1;
+
+    for(int i = 1; i < *argc; i++) {
+        if(strcmp(args[i], "-t") == 0) {
+            if(parseIntOption(*argc, args, i, 1, &(options->threads))) {
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-wd") == 0) {
+            if(parseIntOption(*argc, args, i, 1, &(options->dynamicWindow))) {
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-stats") == 0) {
+            options->stats = true;
+        } else if(strcmp(args[i], "-stream") == 0) {
+            options->streamOutput = true;
+        } else if(strcmp(args[i], "-wf") == 0) {
+            const char* format;
+            if(parseStringOption(*argc, args, i, &format)) {
+                return true;
+            }
+
+            if(strcmp(format, "float") == 0) {
+                options->wireFormat = WIRE_FORMAT_FLOAT;
+            } else if(strcmp(format, "half") == 0) {
+                options->wireFormat = WIRE_FORMAT_HALF;
+            } else if(strcmp(format, "byte") == 0) {
+                options->wireFormat = WIRE_FORMAT_BYTE;
+            } else {
+                std::cout << "ERROR: " << format << " is not a valid value for -wf." << std::endl;
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-to") == 0) {
+            const char* order;
+            if(parseStringOption(*argc, args, i, &order)) {
+                return true;
+            }
+
+            if(strcmp(order, "raster") == 0) {
+                options->tileOrder = TILE_ORDER_RASTER;
+            } else if(strcmp(order, "morton") == 0) {
+                options->tileOrder = TILE_ORDER_MORTON;
+            } else if(strcmp(order, "hilbert") == 0) {
+                options->tileOrder = TILE_ORDER_HILBERT;
+            } else {
+                std::cout << "ERROR: " << order << " is not a valid value for -to." << std::endl;
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-tm") == 0) {
+            const char* toneMap;
+            if(parseStringOption(*argc, args, i, &toneMap)) {
+                return true;
+            }
+
+            if(strcmp(toneMap, "none") == 0) {
+                options->toneMap = TONE_MAP_NONE;
+            } else if(strcmp(toneMap, "reinhard") == 0) {
+                options->toneMap = TONE_MAP_REINHARD;
+            } else if(strcmp(toneMap, "ward") == 0) {
+                options->toneMap = TONE_MAP_WARD;
+            } else {
+                std::cout << "ERROR: " << toneMap << " is not a valid value for -tm." << std::endl;
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-ta") == 0) {
+            options->tileAffinity = true;
+        } else if(strcmp(args[i], "-guided") == 0) {
+            options->guided = true;
+        } else if(strcmp(args[i], "-hg") == 0) {
+            if(parseIntOption(*argc, args, i, 1, &(options->hierarchyGroupSize))) {
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-progressive") == 0) {
+            options->progressive = true;
+        } else if(strcmp(args[i], "-shm") == 0) {
+            options->sharedImage = true;
+        } else if(strcmp(args[i], "-sd") == 0) {
+            if(parseStringOption(*argc, args, i, &(options->sceneDirectory))) {
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-cc") == 0) {
+            if(parseStringOption(*argc, args, i, &(options->costCacheDirectory))) {
+                return true;
+            }
+            i++;
+        } else if(strcmp(args[i], "-p") == 0 && i + 1 < *argc) {
+            // Swap our modes for one the library can check
+            for(int mode = 0; mode < extraPartModeCount; mode++) {
+                if(strcmp(args[i + 1], extraPartModes[mode].name) == 0) {
+                    options->partitioningMode = extraPartModes[mode].mode;
+                    args[i + 1] = (char*) extraPartModes[mode].libraryName;
+                }
+            }
+
+            args[kept++] = args[i++];
+            args[kept++] = args[i];
+        } else if(strcmp(args[i], "-c") == 0 && i + 1 < *argc) {
+            // Needed to name cached data, but the library reads it too
+            options->configFile = args[i + 1];
+
+            args[kept++] = args[i++];
+            args[kept++] = args[i];
+        } else {
+            // Not ours, leave it for the library
+            if(strcmp(args[i], "-help") == 0) {
+                options->help = true;
+            }
+            args[kept++] = args[i];
+        }
+    }
+
+    *argc = kept;
+    args[kept] = NULL;
+
+    // initialize() may rearrange the arguments, so keep our own list
+    sceneArgc = kept;
+    sceneArgv = new char*[kept + 1];
+    memcpy(sceneArgv, args, (kept + 1) * sizeof(char*));
+
+    return false;
+}
+
+void setSceneConfigFile(int argc, char* argv[], const std::string& configFile) {
+    sceneConfigFile = configFile;
+
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "-c") == 0) {
+            argv[i + 1] = (char*) sceneConfigFile.c_str();
+        }
+    }
+
+    for(int i = 1; i + 1 < sceneArgc; i++) {
+        if(strcmp(sceneArgv[i], "-c") == 0) {
+            sceneArgv[i + 1] = (char*) sceneConfigFile.c_str();
+        }
+    }
+}
+
+void applyRenderOptions(ConfigData* data) {
+    if(renderOptions.partitioningMode != PART_MODE_NONE) {
+        data->partitioningMode = renderOptions.partitioningMode;
+    }
+}
+
+void printSequentialIgnoredOptions() {
+    // Each option that differs from its default was given
+    const char* ignored[] = {
+        renderOptions.dynamicWindow != 1 ? "-wd" : NULL,
+        renderOptions.streamOutput ? "-stream" : NULL,
+        renderOptions.wireFormat != WIRE_FORMAT_FLOAT ? "-wf" : NULL,
+        renderOptions.tileOrder != TILE_ORDER_RASTER ? "-to" : NULL,
+        renderOptions.tileAffinity ? "-ta" : NULL,
+        renderOptions.guided ? "-guided" : NULL,
+        renderOptions.hierarchyGroupSize != 0 ? "-hg" : NULL,
+        renderOptions.progressive ? "-progressive" : NULL,
+        renderOptions.sharedImage ? "-shm" : NULL,
+        renderOptions.toneMap != TONE_MAP_NONE ? "-tm" : NULL,
+        renderOptions.sceneDirectory != NULL ? "-sd" : NULL,
+        renderOptions.costCacheDirectory != NULL ? "-cc" : NULL
+    };
+
+    for(size_t i = 0; i < sizeof(ignored) / sizeof(ignored[0]); i++) {
+        if(ignored[i] != NULL) {
+            std::cout << ignored[i] << " is ignored in sequential mode." << std::endl;
+        }
+    }
+}
+
+void printRenderOptionsHelp() {
+    std::cout << "    Additional Partition Types:" << std::endl;
+    std::cout << "        work_stealing - Distributed work stealing between all processes" << std::endl;
+    std::cout << "            -bh required" << std::endl;
+    std::cout << "            -bw required" << std::endl;
+    std::cout << "        static_cost_blocks - Static blocks of equal cost, estimated by a coarse" << std::endl;
+    std::cout << "            pre-pass over the image" << std::endl;
+    std::cout << "            -cc optional" << std::endl;
+    std::cout << "        dynamic_hierarchical - Dynamic partitioning through a sub-master on each" << std::endl;
+    std::cout << "            node, which takes large chunks from rank 0 and hands out their" << std::endl;
+    std::cout << "            tiles to the other ranks of its node" << std::endl;
+    std::cout << "            -bh required" << std::endl;
+    std::cout << "            -bw required" << std::endl;
+    std::cout << "            -hg optional" << std::endl;
+    std::cout << "    Additional Parameters:" << std::endl;
+    std::cout << "        -t     The number of rendering threads per process (default 1)" << std::endl;
+    std::cout << "        -wd    The number of tiles each worker has outstanding when using" << std::endl;
+    std::cout << "               dynamic partitioning (default 1)" << std::endl;
+    std::cout << "        -stats Print additional statistics after the timing results" << std::endl;
+    std::cout << "        -cc    A directory to cache the cost map of static_cost_blocks in," << std::endl;
+    std::cout << "               for reuse by later renders of the same scene and size" << std::endl;
+    std::cout << "        -stream Write the image as rows are completed, holding only the rows" << std::endl;
+    std::cout << "               in progress in memory; dynamic partitioning only" << std::endl;
+    std::cout << "        -wf    The format dynamic partitioning sends pixels to the master in:" << std::endl;
+    std::cout << "               float (default), half, or byte (8 bits, as saved)" << std::endl;
+    std::cout << "        -to    The order dynamic partitioning and work stealing hand out" << std::endl;
+    std::cout << "               tiles in: raster (default), morton, or hilbert" << std::endl;
+    std::cout << "        -ta    Give each dynamic partitioning worker its own run of tiles" << std::endl;
+    std::cout << "               along the -to order, taking from others once it runs out" << std::endl;
+    std::cout << "        -guided Hand out dynamic partitioning tiles as rectangles of -bw by" << std::endl;
+    std::cout << "               -bh tiles that start large and shrink as the work left drops," << std::endl;
+    std::cout << "               but stay large enough for the master to keep up; raster order" << std::endl;
+    std::cout << "        -hg    The number of ranks under each sub-master of" << std::endl;
+    std::cout << "               dynamic_hierarchical (default: every rank of the node)" << std::endl;
+    std::cout << "        -sd    A node-local directory to load the scene from. Rank 0 reads" << std::endl;
+    std::cout << "               the scene's files and sends them to one rank per node," << std::endl;
+    std::cout << "               which writes them there" << std::endl;
+    std::cout << "        -shm   Render the static strips, blocks and cycles modes into an" << std::endl;
+    std::cout << "               image shared by the ranks of each node, so only one part of" << std::endl;
+    std::cout << "               the image per node is sent to the master" << std::endl;
+    std::cout << "        -progressive Render dynamic partitioning in passes of 1/16, 1/4 and" << std::endl;
+    std::cout << "               then all of the image, saving a preview after each pass" << std::endl;
+    std::cout << "        -tm    The operator static partitioning tone maps the image with:" << std::endl;
+    std::cout << "               none (default), reinhard, or ward. Each rank maps its own" << std::endl;
+    std::cout << "               pixels and sends them as 8 bits per channel" << std::endl;
+}
+
+bool startRenderThreads(ConfigData* data) {
+    startThreadPool(renderOptions.threads);
+
+    threadScenes = new ConfigData[renderOptions.threads];
+    for(int i = 1; i < renderOptions.threads; i++) {
+        int argc = sceneArgc;
+        char** argv = new char*[sceneArgc + 1];
+        memcpy(argv, sceneArgv, (sceneArgc + 1) * sizeof(char*));
+
+        bool result = initialize(&argc, &argv, &(threadScenes[i]));
+        delete[] argv;
+        if(result) {
+            return true;
+        }
+
+        applyRenderOptions(&(threadScenes[i]));
+        threadScenes[i].mpi_rank = data->mpi_rank;
+        threadScenes[i].mpi_procs = data->mpi_procs;
+    }
+
+    return false;
+}
+
+void stopRenderThreads() {
+    stopThreadPool();
+
+    for(int i = 1; i < renderOptions.threads; i++) {
+        shutdown(&(threadScenes[i]));
+    }
+
+    delete[] threadScenes;
+    threadScenes = NULL;
+}
+
+ConfigData* getThreadScene(ConfigData* data, int thread) {
+    if(thread == 0) {
+        return data;
+    }
+
+    return &(threadScenes[thread]);
+}
+
+// Splits length into parts, giving the first (length % parts) one extra
+static void splitEvenly(int length, int parts, int part, int* start, int* size) {
+    int base = length / parts;
+    int remainder = length % parts;
+
+    *start = (part * base) + (part < remainder ? part : remainder);
+    *size = base + (part < remainder ? 1 : 0);
+}
+
+void getBlockBounds(ConfigData* data, int rank, int* x, int* y, int* width, int* height) {
+    // Pick the grid whose blocks have the smallest perimeter, so each
+    // process has as little edge as possible for its area
+    int columns = 1;
+    double bestPerimeter = -1.0;
+    for(int c = 1; c <= data->mpi_procs; c++) {
+        if(data->mpi_procs % c != 0) {
+            continue;
+        }
+
+        int r = data->mpi_procs / c;
+        double perimeter = ((double) data->width / c) + ((double) data->height / r);
+        if(bestPerimeter < 0.0 || perimeter < bestPerimeter) {
+            bestPerimeter = perimeter;
+            columns = c;
+        }
+    }
+
+    int rows = data->mpi_procs / columns;
+
+    splitEvenly(data->width, columns, rank % columns, x, width);
+    splitEvenly(data->height, rows, rank / columns, y, height);
+}
+
+unsigned char quantizeChannel(float value) {
+    if(value > 1.0f) {
+        return 255;
+    }
+
+    return (unsigned char)(int)(value * 255.0f);
+}
+
+int getPixelPass(int x, int y) {
+    // Each pass fills in the pixels on a grid twice as fine as the last
+    for(int pass = 0; pass < PROGRESSIVE_PASSES - 1; pass++) {
+        int step = 1 << (PROGRESSIVE_PASSES - 1 - pass);
+        if(x % step == 0 && y % step == 0) {
+            return pass;
+        }
+    }
+
+    return PROGRESSIVE_PASSES - 1;
+}
+
+// Renders the pixels of a region in one progressive pass, or all of them
+// if pass is -1
+static void renderRegionSerial(ConfigData* data, RenderRegion* region, int pass) {
     // Render the given part of the scene
     // Loop over local coordinates
     for(int ry = 0; ry < region->height; ry++) {
@@ -11,6 +400,10 @@ void renderRegion(ConfigData* data, RenderRegion* region) {
             // Get image and pixel coordinates
             int ix = region->xInImage + rx;
             int iy = region->yInImage + ry;
+            if(pass >= 0 && getPixelPass(ix, iy) != pass) {
+                continue;
+            }
+
             int px = region->xInPixels + rx;
             int py = region->yInPixels + ry;
 
@@ -22,3 +415,65 @@ void renderRegion(ConfigData* data, RenderRegion* region) {
         }
     }
 }
+
+// Work shared by the threads rendering one region
+typedef struct {
+    ConfigData* data;
+    RenderRegion* region;
+    int tilesAcross;
+    int pass;
+} RegionJob;
+
+static void renderRegionTile(int tile, int thread, void* arg) {
+    RegionJob* job = (RegionJob*) arg;
+
+    int tileX = THREAD_TILE_SIZE * (tile % job->tilesAcross);
+    int tileY = THREAD_TILE_SIZE * (tile / job->tilesAcross);
+
+    // Same region, narrowed down to the tile
+    RenderRegion tileRegion = *(job->region);
+    tileRegion.xInImage += tileX;
+    tileRegion.yInImage += tileY;
+    tileRegion.xInPixels += tileX;
+    tileRegion.yInPixels += tileY;
+    tileRegion.width = THREAD_TILE_SIZE;
+    tileRegion.height = THREAD_TILE_SIZE;
+
+    // Don't overrun
+    if(tileX + tileRegion.width > job->region->width) {
+        tileRegion.width = job->region->width - tileX;
+    }
+
+    if(tileY + tileRegion.height > job->region->height) {
+        tileRegion.height = job->region->height - tileY;
+    }
+
+    renderRegionSerial(getThreadScene(job->data, thread), &tileRegion, job->pass);
+}
+
+static void renderRegionPixels(ConfigData* data, RenderRegion* region, int pass) {
+    int tilesAcross = (region->width + THREAD_TILE_SIZE - 1) / THREAD_TILE_SIZE;
+    int tilesDown = (region->height + THREAD_TILE_SIZE - 1) / THREAD_TILE_SIZE;
+
+    // Not worth waking the pool for a single tile
+    if(threadPoolSize() == 1 || tilesAcross * tilesDown <= 1) {
+        renderRegionSerial(data, region, pass);
+        return;
+    }
+
+    RegionJob job;
+    job.data = data;
+    job.region = region;
+    job.tilesAcross = tilesAcross;
+    job.pass = pass;
+
+    runTiles(tilesAcross * tilesDown, renderRegionTile, &job);
+}
+
+void renderRegion(ConfigData* data, RenderRegion* region) {
+    renderRegionPixels(data, region, -1);
+}
+
+void renderRegionPass(ConfigData* data, RenderRegion* region, int pass) {
+    renderRegionPixels(data, region, pass);
+}
@@ -0,0 +1,256 @@
+// Cost estimation and cost balanced partitioning for static blocks
+
+#include <mpi.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "threadpool.h"
+#include "costmodel.h"
+#include "scenefiles.h"
+
+// Pixels between cost samples in each direction
+#define COST_SAMPLE_STRIDE 8
+
+// Identifies a cost cache file and the layout it was written with
+#define COST_CACHE_MAGIC "RTCOST02"
+
+// Work shared by the threads sampling the image
+typedef struct {
+    ConfigData* data;
+    CostMap* map;
+} SampleJob;
+
+static void sampleCell(int sample, int thread, void* arg) {
+    SampleJob* job = (SampleJob*) arg;
+    ConfigData* data = job->data;
+    CostMap* map = job->map;
+
+    // Samples are dealt out cyclically between the processes
+    int cell = data->mpi_rank + (sample * data->mpi_procs);
+    int cellX = cell % map->cellsAcross;
+    int cellY = cell / map->cellsAcross;
+
+    // Sample the middle of the cell, staying inside the image
+    int column = (cellX * map->stride) + (map->stride / 2);
+    int row = (cellY * map->stride) + (map->stride / 2);
+    if(column >= data->width) {
+        column = data->width - 1;
+    }
+    if(row >= data->height) {
+        row = data->height - 1;
+    }
+
+    // Pool threads may not call MPI, so no MPI_Wtime here
+    float color[3];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    shadePixel(color, row, column, getThreadScene(data, thread));
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+    map->costs[cell] = std::chrono::duration<double>(stop - start).count();
+}
+
+// Name of the cache file for this scene and image size
+static std::string costCachePath(ConfigData* data, CostMap* map) {
+    std::string scene = renderOptions.configFile;
+    for(size_t i = 0; i < scene.size(); i++) {
+        if(scene[i] == '/' || scene[i] == '.') {
+            scene[i] = '_';
+        }
+    }
+
+    char size[64];
+    snprintf(size, sizeof(size), "_%dx%d_s%d.cost", data->width, data->height, map->stride);
+
+    return std::string(renderOptions.costCacheDirectory) + "/" + scene + size;
+}
+
+// Returns true if a matching cost map was read from the cache. Maps of an
+// older version of the scene's files are ignored, by their hash.
+static bool readCostCache(ConfigData* data, CostMap* map, uint64_t sceneHash) {
+    FILE* file = fopen(costCachePath(data, map).c_str(), "rb");
+    if(file == NULL) {
+        return false;
+    }
+
+    char magic[8];
+    uint64_t hash;
+    int header[5];
+    int expected[5] = { data->width, data->height, map->stride, map->cellsAcross, map->cellsDown };
+    int cellCount = map->cellsAcross * map->cellsDown;
+
+    bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && memcmp(magic, COST_CACHE_MAGIC, sizeof(magic)) == 0
+        && fread(&hash, sizeof(hash), 1, file) == 1
+        && hash == sceneHash
+        && fread(header, sizeof(int), 5, file) == 5
+        && memcmp(header, expected, sizeof(header)) == 0
+        && fread(map->costs, sizeof(double), cellCount, file) == (size_t) cellCount;
+
+    fclose(file);
+    return valid;
+}
+
+static void writeCostCache(ConfigData* data, CostMap* map, uint64_t sceneHash) {
+    FILE* file = fopen(costCachePath(data, map).c_str(), "wb");
+    if(file == NULL) {
+        std::cerr << "Could not write the cost map to " << costCachePath(data, map) << std::endl;
+        return;
+    }
+
+    int header[5] = { data->width, data->height, map->stride, map->cellsAcross, map->cellsDown };
+
+    fwrite(COST_CACHE_MAGIC, 1, 8, file);
+    fwrite(&sceneHash, sizeof(sceneHash), 1, file);
+    fwrite(header, sizeof(int), 5, file);
+    fwrite(map->costs, sizeof(double), map->cellsAcross * map->cellsDown, file);
+    fclose(file);
+}
+
+double buildCostMap(ConfigData* data, CostMap* map) {
+    map->stride = COST_SAMPLE_STRIDE;
+    map->cellsAcross = (data->width + map->stride - 1) / map->stride;
+    map->cellsDown = (data->height + map->stride - 1) / map->stride;
+
+    int cellCount = map->cellsAcross * map->cellsDown;
+    map->costs = new double[cellCount]();
+
+    // Use the cached map if rank 0 has one for the scene as it is now
+    int cached = 0;
+    uint64_t sceneHash = 0;
+    if(data->mpi_rank == 0 && renderOptions.costCacheDirectory != NULL && renderOptions.configFile != NULL) {
+        std::vector<std::string> sceneFiles;
+        listSceneFiles(renderOptions.configFile, &sceneFiles);
+        sceneHash = hashSceneFiles(sceneFiles);
+
+        cached = readCostCache(data, map, sceneHash);
+    }
+
+    MPI_Bcast(&cached, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(cached) {
+        MPI_Bcast(map->costs, cellCount, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        return 0.0;
+    }
+
+    // Time our share of the samples
+    double samplingStart = MPI_Wtime();
+
+    SampleJob job;
+    job.data = data;
+    job.map = map;
+
+    int ourSamples = (cellCount - data->mpi_rank + data->mpi_procs - 1) / data->mpi_procs;
+    runTiles(ourSamples, sampleCell, &job);
+
+    double samplingTime = MPI_Wtime() - samplingStart;
+
+    // Every cell was timed by exactly one process, the rest hold 0
+    MPI_Allreduce(MPI_IN_PLACE, map->costs, cellCount, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    if(data->mpi_rank == 0 && renderOptions.costCacheDirectory != NULL && renderOptions.configFile != NULL) {
+        writeCostCache(data, map, sceneHash);
+    }
+
+    return samplingTime;
+}
+
+void freeCostMap(CostMap* map) {
+    delete[] map->costs;
+    map->costs = NULL;
+}
+
+// Adds up the estimated cost of each column (or row) of a rectangle
+static void lineCosts(CostMap* map, int x, int y, int width, int height, bool columns, std::vector<double>& costs) {
+    int lines = columns ? width : height;
+    int across = columns ? height : width;
+    int lineStart = columns ? x : y;
+    int acrossStart = columns ? y : x;
+
+    costs.assign(lines, 0.0);
+
+    for(int line = 0; line < lines; line++) {
+        int lineCell = (lineStart + line) / map->stride;
+
+        // Walk the cells the line passes through
+        int position = acrossStart;
+        while(position < acrossStart + across) {
+            int acrossCell = position / map->stride;
+            int cellEnd = (acrossCell + 1) * map->stride;
+            if(cellEnd > acrossStart + across) {
+                cellEnd = acrossStart + across;
+            }
+
+            int cell = columns ? (acrossCell * map->cellsAcross) + lineCell : (lineCell * map->cellsAcross) + acrossCell;
+            costs[line] += map->costs[cell] * (cellEnd - position);
+
+            position = cellEnd;
+        }
+    }
+}
+
+static void bisect(CostMap* map, int x, int y, int width, int height, int firstRank, int ranks, int* rects) {
+    if(ranks == 1) {
+        rects[(4 * firstRank) + 0] = x;
+        rects[(4 * firstRank) + 1] = y;
+        rects[(4 * firstRank) + 2] = width;
+        rects[(4 * firstRank) + 3] = height;
+        return;
+    }
+
+    // Cut across the longer side, giving each half a share of the cost
+    // proportional to its number of ranks
+    bool columns = width >= height;
+    int length = columns ? width : height;
+    int firstRanks = ranks / 2;
+
+    std::vector<double> costs;
+    lineCosts(map, x, y, width, height, columns, costs);
+
+    double total = 0.0;
+    for(int i = 0; i < length; i++) {
+        total += costs[i];
+    }
+
+    int cut;
+    if(total <= 0.0) {
+        // Nothing measured, split by area instead
+        cut = (length * firstRanks) / ranks;
+    } else {
+        double target = (total * firstRanks) / ranks;
+        double before = 0.0;
+
+        cut = 0;
+        while(cut < length && before + costs[cut] < target) {
+            before += costs[cut];
+            cut++;
+        }
+
+        // Take the line too if that lands closer to the target
+        if(cut < length && (before + costs[cut]) - target < target - before) {
+            cut++;
+        }
+    }
+
+    // Keep a line on each side, so no group is left with an empty rectangle
+    if(length > 1) {
+        cut = std::max(1, std::min(cut, length - 1));
+    }
+
+    if(columns) {
+        bisect(map, x, y, cut, height, firstRank, firstRanks, rects);
+        bisect(map, x + cut, y, width - cut, height, firstRank + firstRanks, ranks - firstRanks, rects);
+    } else {
+        bisect(map, x, y, width, cut, firstRank, firstRanks, rects);
+        bisect(map, x, y + cut, width, height - cut, firstRank + firstRanks, ranks - firstRanks, rects);
+    }
+}
+
+void partitionByCost(ConfigData* data, CostMap* map, int* rects) {
+    bisect(map, 0, 0, data->width, data->height, 0, data->mpi_procs, rects);
+}
@@ -0,0 +1,389 @@
+// Hierarchical dynamic partitioning: a sub-master on each node sits
+// between rank 0 and the workers of the node
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "hierarchy.h"
+#include "wireformat.h"
+
+// A chunk of the image handed to a sub-master by rank 0
+typedef struct {
+    // Region of the image the chunk covers
+    int x;
+    int y;
+    int width;
+    int height;
+
+    // Tiles of the chunk, in raster order of its tiles
+    int tilesAcross;
+    int tileCount;
+
+    // Next tile to hand out, and the number still to be recieved
+    int nextTile;
+    int tilesLeft;
+
+    // Rendered pixels of the chunk, packed to its width
+    float* pixels;
+
+    // Time the workers spent rendering the tiles of the chunk
+    double computationTime;
+} Chunk;
+
+// A tile of a chunk handed out to a worker
+typedef struct {
+    Chunk* chunk;
+    int x;
+    int y;
+    int width;
+    int height;
+} LocalTile;
+
+// A worker of a sub-master
+typedef struct {
+    // Tiles handed out to the worker and not yet recieved, oldest first
+    std::deque<LocalTile> outstanding;
+
+    // The oldest tile as it is recieved
+    TileHeader header;
+    unsigned char* wire;
+    MPI_Datatype type;
+} LocalWorker;
+
+// A complete chunk on its way to rank 0
+typedef struct {
+    TileHeader header;
+    unsigned char* wire;
+    MPI_Request request;
+} ChunkSend;
+
+void splitDynamicHierarchy(ConfigData* data, DynamicHierarchy* hierarchy) {
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, data->mpi_rank, MPI_INFO_NULL, &node);
+
+    int nodeRank;
+    MPI_Comm_rank(node, &nodeRank);
+
+    // Rank 0 only hands out chunks, so the rest of its node is grouped as
+    // if it were not there. It is always first on its node.
+    int hasMaster = (data->mpi_rank == 0);
+    MPI_Allreduce(MPI_IN_PLACE, &hasMaster, 1, MPI_INT, MPI_LOR, node);
+
+    int color = MPI_UNDEFINED;
+    if(data->mpi_rank != 0) {
+        int position = hasMaster ? nodeRank - 1 : nodeRank;
+        color = renderOptions.hierarchyGroupSize > 0 ? position / renderOptions.hierarchyGroupSize : 0;
+    }
+
+    MPI_Comm_split(node, color, data->mpi_rank, &(hierarchy->group));
+    MPI_Comm_free(&node);
+
+    int groupRank = -1;
+    if(hierarchy->group != MPI_COMM_NULL) {
+        MPI_Comm_rank(hierarchy->group, &groupRank);
+    }
+
+    bool leader = (data->mpi_rank == 0) || (groupRank == 0);
+    MPI_Comm_split(MPI_COMM_WORLD, leader ? 0 : MPI_UNDEFINED, data->mpi_rank, &(hierarchy->leaders));
+}
+
+void freeDynamicHierarchy(DynamicHierarchy* hierarchy) {
+    if(hierarchy->group != MPI_COMM_NULL) {
+        MPI_Comm_free(&(hierarchy->group));
+    }
+
+    if(hierarchy->leaders != MPI_COMM_NULL) {
+        MPI_Comm_free(&(hierarchy->leaders));
+    }
+}
+
+// Starts recieving the oldest outstanding tile of worker w
+static void recieveLocalTile(LocalWorker* worker, int w, MPI_Comm group, MPI_Datatype headerType, MPI_Request* request) {
+    LocalTile* tile = &(worker->outstanding.front());
+
+    MPI_Datatype pixelsType;
+    MPI_Type_contiguous(3 * tile->width * tile->height, wireChannelType(renderOptions.wireFormat), &pixelsType);
+    MPI_Type_commit(&pixelsType);
+
+    worker->type = createTileMessageType(headerType, &(worker->header), pixelsType, worker->wire);
+    MPI_Type_free(&pixelsType);
+
+    MPI_Irecv(MPI_BOTTOM, 1, worker->type, w + 1, 0, group, request);
+}
+
+// Takes the next tile of a chunk
+static LocalTile takeChunkTile(ConfigData* data, Chunk* chunk) {
+    LocalTile tile;
+    tile.chunk = chunk;
+    tile.x = chunk->x + (data->dynamicBlockWidth * (chunk->nextTile % chunk->tilesAcross));
+    tile.y = chunk->y + (data->dynamicBlockHeight * (chunk->nextTile / chunk->tilesAcross));
+    tile.width = std::min(data->dynamicBlockWidth, chunk->x + chunk->width - tile.x);
+    tile.height = std::min(data->dynamicBlockHeight, chunk->y + chunk->height - tile.y);
+
+    chunk->nextTile++;
+    return tile;
+}
+
+// Starts sending a complete chunk to rank 0, along with the idle time of
+// the workers since the last one
+static ChunkSend* sendChunk(Chunk* chunk, double idleTime, MPI_Comm leaders, MPI_Datatype headerType) {
+    WireFormat format = renderOptions.wireFormat;
+    int channels = 3 * chunk->width * chunk->height;
+
+    ChunkSend* send = new ChunkSend;
+    send->header.x = chunk->x;
+    send->header.y = chunk->y;
+    send->header.width = chunk->width;
+    send->header.height = chunk->height;
+    send->header.computationTime = chunk->computationTime;
+    send->header.idleTime = idleTime;
+
+    send->wire = new unsigned char[channels * wireChannelSize(format)];
+    encodePixels(format, chunk->pixels, channels, send->wire);
+
+    MPI_Datatype pixelsType;
+    MPI_Type_contiguous(channels, wireChannelType(format), &pixelsType);
+    MPI_Type_commit(&pixelsType);
+
+    MPI_Datatype messageType = createTileMessageType(headerType, &(send->header), pixelsType, send->wire);
+    MPI_Isend(MPI_BOTTOM, 1, messageType, 0, 0, leaders, &(send->request));
+
+    // Freed once the send is done
+    MPI_Type_free(&messageType);
+    MPI_Type_free(&pixelsType);
+
+    return send;
+}
+
+long long runSubMaster(ConfigData* data, DynamicHierarchy* hierarchy) {
+    MPI_Status status;
+    MPI_Comm group = hierarchy->group;
+    MPI_Comm leaders = hierarchy->leaders;
+    WireFormat format = renderOptions.wireFormat;
+    int window = renderOptions.dynamicWindow;
+
+    int groupSize;
+    MPI_Comm_size(group, &groupSize);
+    int workers = groupSize - 1;
+
+    MPI_Datatype headerType = createTileHeaderType();
+
+    /*
+     * 1.   Recieve chunks from rank 0 as (x y width height) ints, and queue
+     *      them in the order they came in
+     * 2.   Hand out the tiles of the oldest chunks to the workers, up to
+     *      window tiles outstanding per worker, as in the centralized queue
+     * 3.   Wait for a tile from any worker, or another chunk from rank 0
+     * 4.   Place the tile in its chunk, and send every complete chunk at
+     *      the front of the queue to rank 0, in order, as one message
+     * 5.   Until rank 0 sends -1 -1 -1 -1 and every chunk is sent, continue
+     *      from 2.
+     * 6.   Send -1 -1 -1 -1 to the workers, and pass the idle time in their
+     *      last headers on to rank 0 in our own
+     */
+
+    std::deque<Chunk*> chunks;
+    std::vector<ChunkSend*> sends;
+
+    int tileChannels = 3 * data->dynamicBlockWidth * data->dynamicBlockHeight;
+    std::vector<LocalWorker> localWorkers(workers);
+    for(int w = 0; w < workers; w++) {
+        localWorkers[w].wire = new unsigned char[tileChannels * wireChannelSize(format)];
+    }
+    float* tilePixels = new float[tileChannels];
+
+    // One request per worker, then the one for the next chunk
+    std::vector<MPI_Request> requests(workers + 1, MPI_REQUEST_NULL);
+
+    int chunkPacket[4];
+    MPI_Irecv(chunkPacket, 4, MPI_INT, 0, 0, leaders, &(requests[workers]));
+    bool lastChunk = false;
+
+    // Idle time the workers reported since the last chunk was sent
+    double idleTime = 0.0;
+    long long messages = 0;
+
+    while(true) {
+        if(workers == 0) {
+            // Nobody to hand tiles to, render the chunks ourselves
+            for(size_t c = 0; c < chunks.size(); c++) {
+                Chunk* chunk = chunks[c];
+                if(chunk->nextTile == chunk->tileCount) {
+                    continue;
+                }
+
+                double computationStart = MPI_Wtime();
+
+                RenderRegion region;
+                region.xInImage = chunk->x;
+                region.yInImage = chunk->y;
+                region.xInPixels = 0;
+                region.yInPixels = 0;
+                region.width = chunk->width;
+                region.height = chunk->height;
+                region.pixelsWidth = chunk->width;
+                region.pixelsHeight = chunk->height;
+                region.pixels = chunk->pixels;
+                renderRegion(data, &region);
+
+                chunk->computationTime += MPI_Wtime() - computationStart;
+                chunk->nextTile = chunk->tileCount;
+                chunk->tilesLeft = 0;
+            }
+        }
+
+        // Hand out tiles a round at a time, so every worker gets a share
+        size_t nextChunk = 0;
+        bool handedOut = true;
+        while(handedOut) {
+            handedOut = false;
+            for(int w = 0; w < workers; w++) {
+                while(nextChunk < chunks.size() && chunks[nextChunk]->nextTile == chunks[nextChunk]->tileCount) {
+                    nextChunk++;
+                }
+
+                if(nextChunk == chunks.size()) {
+                    break;
+                }
+
+                LocalWorker* worker = &(localWorkers[w]);
+                if((int) worker->outstanding.size() >= window) {
+                    continue;
+                }
+
+                LocalTile tile = takeChunkTile(data, chunks[nextChunk]);
+                int workPacket[4] = { tile.x, tile.y, tile.width, tile.height };
+                MPI_Send(workPacket, 4, MPI_INT, w + 1, 0, group);
+                messages++;
+
+                worker->outstanding.push_back(tile);
+                if(worker->outstanding.size() == 1) {
+                    recieveLocalTile(worker, w, group, headerType, &(requests[w]));
+                }
+
+                handedOut = true;
+            }
+        }
+
+        // Send complete chunks, in the order rank 0 handed them out
+        while(!chunks.empty() && chunks.front()->tilesLeft == 0) {
+            Chunk* chunk = chunks.front();
+            chunks.pop_front();
+
+            sends.push_back(sendChunk(chunk, idleTime, leaders, headerType));
+            idleTime = 0.0;
+
+            delete[] chunk->pixels;
+            delete chunk;
+        }
+
+        // Free the chunks that have made it to rank 0
+        for(size_t i = 0; i < sends.size(); i++) {
+            int sent;
+            MPI_Test(&(sends[i]->request), &sent, &status);
+            if(sent) {
+                delete[] sends[i]->wire;
+                delete sends[i];
+                sends.erase(sends.begin() + i);
+                i--;
+            }
+        }
+
+        if(lastChunk && chunks.empty()) {
+            break;
+        }
+
+        int index;
+        MPI_Waitany(workers + 1, requests.data(), &index, &status);
+
+        if(index == workers) {
+            if(chunkPacket[0] == -1) {
+                lastChunk = true;
+                continue;
+            }
+
+            Chunk* chunk = new Chunk;
+            chunk->x = chunkPacket[0];
+            chunk->y = chunkPacket[1];
+            chunk->width = chunkPacket[2];
+            chunk->height = chunkPacket[3];
+            chunk->tilesAcross = (chunk->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+            chunk->tileCount = chunk->tilesAcross * ((chunk->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight);
+            chunk->nextTile = 0;
+            chunk->tilesLeft = chunk->tileCount;
+            chunk->pixels = new float[3 * chunk->width * chunk->height];
+            chunk->computationTime = 0.0;
+            chunks.push_back(chunk);
+
+            MPI_Irecv(chunkPacket, 4, MPI_INT, 0, 0, leaders, &(requests[workers]));
+            continue;
+        }
+
+        // A tile from a worker, place it in its chunk
+        LocalWorker* worker = &(localWorkers[index]);
+        MPI_Type_free(&(worker->type));
+        messages++;
+
+        LocalTile tile = worker->outstanding.front();
+        worker->outstanding.pop_front();
+
+        Chunk* chunk = tile.chunk;
+        decodePixels(format, worker->wire, 3 * tile.width * tile.height, tilePixels);
+        for(int row = 0; row < tile.height; row++) {
+            float* destination = &(chunk->pixels[3 * (((tile.y - chunk->y + row) * chunk->width) + (tile.x - chunk->x))]);
+            memcpy(destination, &(tilePixels[3 * row * tile.width]), 3 * tile.width * sizeof(float));
+        }
+
+        chunk->tilesLeft--;
+        chunk->computationTime += worker->header.computationTime;
+        idleTime += worker->header.idleTime;
+
+        if(!worker->outstanding.empty()) {
+            recieveLocalTile(worker, index, group, headerType, &(requests[index]));
+        }
+    }
+
+    // Let the workers go, and collect how long they were idle at the end
+    int donePacket[4] = { -1, -1, -1, -1 };
+    for(int w = 0; w < workers; w++) {
+        MPI_Send(donePacket, 4, MPI_INT, w + 1, 0, group);
+        messages++;
+    }
+
+    for(int w = 0; w < workers; w++) {
+        TileHeader header;
+        MPI_Recv(&header, 1, headerType, w + 1, 0, group, &status);
+        idleTime += header.idleTime;
+        messages++;
+    }
+
+    for(size_t i = 0; i < sends.size(); i++) {
+        MPI_Wait(&(sends[i]->request), &status);
+        delete[] sends[i]->wire;
+        delete sends[i];
+    }
+
+    // Our last header, with no pixels
+    TileHeader lastHeader;
+    lastHeader.x = 0;
+    lastHeader.y = 0;
+    lastHeader.width = 0;
+    lastHeader.height = 0;
+    lastHeader.computationTime = 0.0;
+    lastHeader.idleTime = idleTime;
+    MPI_Send(&lastHeader, 1, headerType, 0, 0, leaders);
+
+    // clean up
+    MPI_Type_free(&headerType);
+    for(int w = 0; w < workers; w++) {
+        delete[] localWorkers[w].wire;
+    }
+    delete[] tilePixels;
+
+    return messages;
+}
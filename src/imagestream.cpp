@@ -0,0 +1,145 @@
+// Streams the rendered image to a PNG as the rows of it are completed
+
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <iostream>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "imagestream.h"
+
+// Frees libpng, closes and removes the partial file after an error, and
+// marks the stream as failed so the rest of the image is thrown away
+static void failImageStream(ImageStream* stream) {
+    png_destroy_write_struct(&(stream->png), &(stream->info));
+    fclose(stream->file);
+    remove(stream->path.c_str());
+    stream->file = NULL;
+    stream->failed = true;
+}
+
+bool openImageStream(ImageStream* stream, std::string file, ConfigData* data) {
+    stream->file = fopen(file.c_str(), "wb");
+    if(stream->file == NULL) {
+        std::cout << "There was an error opening the file at: " << file << std::endl;
+        return true;
+    }
+    stream->path = file;
+
+    stream->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    stream->info = stream->png != NULL ? png_create_info_struct(stream->png) : NULL;
+    if(stream->info == NULL) {
+        std::cout << "There was an error starting the PNG at: " << file << std::endl;
+        failImageStream(stream);
+        return true;
+    }
+
+    // libpng jumps back here on any error instead of aborting
+    if(setjmp(png_jmpbuf(stream->png))) {
+        std::cout << "There was an error writing the PNG at: " << file << std::endl;
+        failImageStream(stream);
+        return true;
+    }
+
+    png_init_io(stream->png, stream->file);
+    png_set_IHDR(stream->png, stream->info, data->width, data->height, 8, PNG_COLOR_TYPE_RGB,
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(stream->png, stream->info);
+
+    stream->failed = false;
+    stream->width = data->width;
+    stream->height = data->height;
+    stream->nextRow = 0;
+    stream->rows.assign(data->height, NULL);
+    stream->missingPixels.assign(data->height, data->width);
+    stream->heldRows = 0;
+    stream->peakHeldRows = 0;
+    stream->encodeTime = 0.0;
+
+    return false;
+}
+
+bool streamPixels(ImageStream* stream, float* pixels, int x, int y, int width, int height) {
+    if(stream->failed) {
+        return true;
+    }
+
+    if(setjmp(png_jmpbuf(stream->png))) {
+        std::cout << "ERROR: The streamed image could not be written, the rest of it will be discarded." << std::endl;
+        failImageStream(stream);
+        return true;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(int row = 0; row < height; row++) {
+        unsigned char*& imageRow = stream->rows[y + row];
+        if(imageRow == NULL) {
+            imageRow = new unsigned char[3 * stream->width];
+            stream->heldRows++;
+        }
+
+        float* source = &(pixels[3 * row * width]);
+        unsigned char* destination = &(imageRow[3 * x]);
+        for(int i = 0; i < 3 * width; i++) {
+            destination[i] = quantizeChannel(source[i]);
+        }
+
+        stream->missingPixels[y + row] -= width;
+    }
+
+    if(stream->heldRows > stream->peakHeldRows) {
+        stream->peakHeldRows = stream->heldRows;
+    }
+
+    // Write out every complete row we can, in order
+    while(stream->nextRow < stream->height && stream->missingPixels[stream->nextRow] == 0) {
+        png_write_row(stream->png, stream->rows[stream->nextRow]);
+
+        delete[] stream->rows[stream->nextRow];
+        stream->rows[stream->nextRow] = NULL;
+        stream->heldRows--;
+        stream->nextRow++;
+    }
+
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    stream->encodeTime += std::chrono::duration<double>(stop - start).count();
+    return false;
+}
+
+// Frees the rows still held
+static void freeStreamRows(ImageStream* stream) {
+    for(int i = 0; i < stream->height; i++) {
+        delete[] stream->rows[i];
+    }
+    stream->rows.clear();
+    stream->missingPixels.clear();
+}
+
+bool closeImageStream(ImageStream* stream) {
+    freeStreamRows(stream);
+    if(stream->failed) {
+        return true;
+    }
+
+    // Never leave a truncated image that looks complete
+    if(stream->nextRow < stream->height) {
+        std::cout << "ERROR: Only " << stream->nextRow << " of " << stream->height << " rows were streamed." << std::endl;
+        failImageStream(stream);
+        return true;
+    }
+
+    if(setjmp(png_jmpbuf(stream->png))) {
+        failImageStream(stream);
+        return true;
+    }
+
+    png_write_end(stream->png, NULL);
+    png_destroy_write_struct(&(stream->png), &(stream->info));
+
+    // Buffered data only reaches the disk here
+    bool error = fclose(stream->file) != 0;
+    stream->file = NULL;
+    return error;
+}
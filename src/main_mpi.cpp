@@ -13,25 +13,87 @@ using namespace std;
 #include "RayTrace.h"
 #include "master.h"
 #include "slave.h"
+#include "common.h"
+#include "scenefiles.h"
 
 int main( int argc, char* argv[] ) 
 {
     //Keep the data that will be used for the scene.
     ConfigData data;
     
+    //Pull out the options that the library does not know about.
+    bool badOptions = parseRenderOptions(&argc, &argv, &renderOptions);
+
+    //MPI Intialization
+    //Only the main thread makes MPI calls; the pool threads just render.
+    //This comes before the scene is loaded, so rank 0 can share its files.
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    double loadStart = MPI_Wtime();
+
+    //Bad options can only be reported once MPI is running.
+    if( badOptions )
+    {
+        MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+    }
+
+    if( provided < MPI_THREAD_FUNNELED )
+    {
+        std::cout << "ERROR: The MPI library does not support calls from the main thread of a threaded process." << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+    }
+
+    //Have rank 0 read the scene's files and copy them to every node, so
+    //the shared file system is read once rather than by every rank.
+    long long sceneBytes = 0;
+    if( renderOptions.sceneDirectory != NULL && renderOptions.configFile != NULL )
+    {
+        std::string localConfigFile;
+        if( shareSceneFiles(renderOptions.configFile, renderOptions.sceneDirectory, &localConfigFile, &sceneBytes) )
+        {
+            MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+        }
+        setSceneConfigFile(argc, argv, localConfigFile);
+    }
+    else if( renderOptions.sceneDirectory != NULL )
+    {
+        //The scene's files are only known from -c.
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        if( rank == 0 )
+        {
+            std::cout << "-sd requires -c <configFile>, it will be ignored." << std::endl;
+        }
+    }
+
     //Try to initialize the scene.
     bool result = initialize(&argc, &argv, &data);
     //Make sure that the initialization was completed.	
     if( result )
     {
+        if( renderOptions.help )
+        {
+            printRenderOptionsHelp();
+        }
         MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
     }
 
-    //MPI Intialization
-    MPI_Init(&argc, &argv);
+    //Switch to any partitioning mode that the library does not know about.
+    applyRenderOptions(&data);
+
     MPI_Comm_rank(MPI_COMM_WORLD, &data.mpi_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &data.mpi_procs);
 
+    //Start the rendering threads for this process.
+    if( startRenderThreads(&data) )
+    {
+        MPI_Abort(MPI_COMM_WORLD, MPI_ERR_OTHER);
+    }
+
+    //Startup lasts until the slowest rank has its scene loaded.
+    double loadTime = MPI_Wtime() - loadStart;
+    MPI_Reduce(data.mpi_rank == 0 ? MPI_IN_PLACE : &loadTime, &loadTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
     if( data.mpi_rank == 0 )
     {
         //Create the output directory where all of the renders will be saved.
@@ -57,6 +119,18 @@ int main( int argc, char* argv[] )
         //Print out the other properties as well
         std::cout << "Dynamic block size: " << data.dynamicBlockWidth << " x " << data.dynamicBlockHeight << std::endl;
         std::cout << "Cycle Size: " << data.cycleSize << std::endl; 
+        if( renderOptions.threads > 1 )
+        {
+            std::cout << "Threads per Process: " << renderOptions.threads << std::endl;
+        }
+        if( renderOptions.stats )
+        {
+            std::cout << "Scene Load Time: " << loadTime << " seconds" << std::endl;
+            if( renderOptions.sceneDirectory != NULL )
+            {
+                std::cout << "Scene Bytes Broadcast: " << sceneBytes << std::endl;
+            }
+        }
 
         //Start the main processing for the ray tracer.
         masterMain( &data );
@@ -66,6 +140,9 @@ int main( int argc, char* argv[] )
         slaveMain( &data );
     }
 
+    //Stop the rendering threads.
+    stopRenderThreads();
+
     //Clean up the scene and other data.
     shutdown(&data);
 
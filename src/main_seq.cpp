@@ -13,6 +13,16 @@
 using namespace std;
 
 #include "RayTrace.h"
+#include "common.h"
+
+//Returns the wall-clock time in seconds. clock() would add up the CPU time
+//of every rendering thread instead.
+static double wallTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
 
 int main( int argc, char* argv[] ) 
 {
@@ -32,14 +42,27 @@ int main( int argc, char* argv[] )
         }
     }
     
+    //Pull out the options that the library does not know about.
+    if( parseRenderOptions(&argc, &argv, &renderOptions) )
+    {
+        return 1;
+    }
+
     //Try to initialize the scene.
     bool result = initialize(&argc, &argv, &data);
     //Make sure that the initialization was completed.	
     if( result )
     {
+        if( renderOptions.help )
+        {
+            printRenderOptionsHelp();
+        }
         return 1;
     }
 
+    //Switch to any partitioning mode that the library does not know about.
+    applyRenderOptions(&data);
+
     //Fill in the MPI related data
     data.mpi_rank = 0;
     data.mpi_procs = 1;
@@ -49,40 +72,82 @@ int main( int argc, char* argv[] )
     std::cout << "Width x Height: " << data.width << " x " << data.height << std::endl;
     std::cout << "Partitioning scheme: " << data.partitioningMode << std::endl;
     std::cout << "Number of Processes: " << 1 << std::endl;
+    if( renderOptions.threads > 1 )
+    {
+        std::cout << "Threads per Process: " << renderOptions.threads << std::endl;
+    }
+    printSequentialIgnoredOptions();
+
+    //Start the rendering threads.
+    if( startRenderThreads(&data) )
+    {
+        return 1;
+    }
 
     //Allocate enough space.
     float* pixels = new float[ 3 * data.width * data.height ];
-    clock_t start = clock();
+    double start = wallTime();
 
-    //Render the scene.
-    for( int i = 0; i < data.height; ++i )
+    if( renderOptions.threads > 1 )
     {
-        for( int j = 0; j < data.width; ++j )
+        //Render the scene as tiles shared by the threads. Every pixel is
+        //shaded exactly as in the loop below, so the image is identical.
+        RenderRegion region;
+        region.xInImage = 0;
+        region.yInImage = 0;
+        region.xInPixels = 0;
+        region.yInPixels = 0;
+        region.width = data.width;
+        region.height = data.height;
+        region.pixelsWidth = data.width;
+        region.pixelsHeight = data.height;
+        region.pixels = pixels;
+
+        renderRegion(&data, &region);
+    }
+    else
+    {
+        //Render the scene.
+        for( int i = 0; i < data.height; ++i )
         {
-            int row = i;
-            int column = j;
+            for( int j = 0; j < data.width; ++j )
+            {
+                int row = i;
+                int column = j;
 
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * data.width + column );
+                //Calculate the index into the array.
+                int baseIndex = 3 * ( row * data.width + column );
 
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]),row,j,&data);
+                //Call the function to shade the pixel.
+                shadePixel(&(pixels[baseIndex]),row,j,&data);
+            }
         }
     }
 
     //Stop the timing.
-    clock_t stop = clock();
+    double stop = wallTime();
 
     //Figure out how much time was taken.
-    float time = (float)(stop - start) / (float)CLOCKS_PER_SEC;
+    float time = (float)(stop - start);
     std::cout << "Execution Time: " << time << " seconds" << std::endl << std::endl;
 
+    //One primary ray per pixel, so this is the rate to compare library
+    //builds by on the same scene and size.
+    if( renderOptions.stats )
+    {
+        double pixelsShaded = (double)data.width * data.height;
+        std::cout << "Pixels Shaded per Second: " << pixelsShaded / (stop - start) << std::endl << std::endl;
+    }
+
     //Now save the image.
     std::cout << "Image will be save to: ";
     std::string file = "renders/" + generateFileName();
     std::cout << file << std::endl;
     savePixels(file, pixels, &data);
     
+    //Stop the rendering threads.
+    stopRenderThreads();
+
     //Clean up the scene and other data.
     shutdown(&data);
 
@@ -1,13 +1,231 @@
 //This file contains the code that the master process will execute.
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <mpi.h>
 #include <cstring>
+#include <cstdio>
 #include <math.h>
+#include <thread>
+#include <vector>
 
 #include "RayTrace.h"
 #include "master.h"
 #include "common.h"
+#include "workstealing.h"
+#include "costmodel.h"
+#include "imagestream.h"
+#include "wireformat.h"
+#include "tileorder.h"
+#include "hierarchy.h"
+#include "sharedimage.h"
+#include "progressive.h"
+#include "tonemap.h"
+
+// Creates a datatype for a width x height block of pixels in the image.
+// Receive with it at the address of the block's first pixel.
+static MPI_Datatype createImageBlockType(ConfigData* data, int width, int height) {
+    MPI_Datatype blockType;
+    MPI_Type_vector(height, 3 * width, 3 * data->width, MPI_FLOAT, &blockType);
+    MPI_Type_commit(&blockType);
+    return blockType;
+}
+
+// Recieves a slave's computation time, sent after its pixels
+static double recieveComputationTime(int rank) {
+    MPI_Status status;
+    double computationTime;
+    MPI_Recv(&computationTime, 1, MPI_DOUBLE, rank, 0, MPI_COMM_WORLD, &status);
+    return computationTime;
+}
+
+// How the time spent gathering the static modes' results was spent
+typedef struct {
+    // No slave had finished rendering, waiting on the slowest ones
+    double waitTime;
+
+    // At least one slave had finished and its pixels were on their way
+    double transferTime;
+} GatherTimes;
+
+// Copies pixels between a packed buffer and their places in the image
+// described by a datatype, as if they were sent to ourselves
+static void copyTypedPixels(float* packed, int channels, float* image, MPI_Datatype type, bool toImage) {
+    if(toImage) {
+        MPI_Sendrecv(packed, channels, MPI_FLOAT, 0, 0, image, 1, type, 0, 0, MPI_COMM_SELF, MPI_STATUS_IGNORE);
+    } else {
+        MPI_Sendrecv(image, 1, type, 0, 0, packed, channels, MPI_FLOAT, 0, 0, MPI_COMM_SELF, MPI_STATUS_IGNORE);
+    }
+}
+
+// Gets the number of channels in a datatype of float pixels
+static int getTypeChannels(MPI_Datatype type) {
+    int size;
+    MPI_Type_size(type, &size);
+    return size / sizeof(float);
+}
+
+/*
+ * Recieves the results of every slave in the static modes, in the order
+ * that the slaves finish rather than in rank order. Each slave sends its
+ * computation time as soon as it is done rendering, then its pixels.
+ * Rank i's pixels are recieved at pixels + offsets[i] with types[i].
+ * When tone mapping, our own pixels at pixels + offsets[0] are tone
+ * mapped alongside the slaves', which send theirs as 8 bits per channel.
+ *
+ * @return Total computation time of the slaves
+ */
+static double gatherStaticResults(ConfigData* data, float* pixels, MPI_Datatype* types, int* offsets, GatherTimes* times) {
+    int slaves = data->mpi_procs - 1;
+    bool toneMapping = usesToneMapping(data);
+
+    // Tone mapped pixels arrive packed, into a buffer for each slave
+    std::vector<std::vector<unsigned char> > quantized(slaves);
+
+    // Computation times first, then pixels, one of each per slave
+    std::vector<MPI_Request> requests(2 * slaves);
+    std::vector<double> slaveTimes(slaves);
+    for(int i = 1; i < data->mpi_procs; i++) {
+        MPI_Irecv(&(slaveTimes[i - 1]), 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &(requests[i - 1]));
+
+        if(toneMapping) {
+            quantized[i - 1].resize(getTypeChannels(types[i]));
+            MPI_Irecv(quantized[i - 1].data(), quantized[i - 1].size(), MPI_UNSIGNED_CHAR, i, 0, MPI_COMM_WORLD, &(requests[slaves + i - 1]));
+        } else {
+            MPI_Irecv(&(pixels[offsets[i]]), 1, types[i], i, 0, MPI_COMM_WORLD, &(requests[slaves + i - 1]));
+        }
+    }
+
+    // Our pixels go through the same 8 bits as the slaves', so the image
+    // is saved the same whichever rank rendered a pixel
+    std::vector<float> unpacked;
+    if(toneMapping) {
+        int channels = getTypeChannels(types[0]);
+        std::vector<unsigned char> ours(channels);
+        unpacked.resize(channels);
+
+        copyTypedPixels(unpacked.data(), channels, &(pixels[offsets[0]]), types[0], false);
+        toneMapPixels(unpacked.data(), channels, ours.data());
+        decodePixels(WIRE_FORMAT_BYTE, ours.data(), channels, unpacked.data());
+        copyTypedPixels(unpacked.data(), channels, &(pixels[offsets[0]]), types[0], true);
+    }
+
+    // Whether each slave's time and pixels have come in
+    std::vector<bool> timeRecieved(slaves, false);
+    std::vector<bool> pixelsRecieved(slaves, false);
+    int transferring = 0;
+
+    times->waitTime = 0.0;
+    times->transferTime = 0.0;
+    double last = MPI_Wtime();
+
+    for(int i = 0; i < 2 * slaves; i++) {
+        int index;
+        MPI_Status status;
+        MPI_Waitany(2 * slaves, requests.data(), &index, &status);
+
+        // Charge the time since the last message to whatever we were doing
+        double now = MPI_Wtime();
+        if(transferring > 0) {
+            times->transferTime += now - last;
+        } else {
+            times->waitTime += now - last;
+        }
+        last = now;
+
+        int slave = index % slaves;
+        if(index < slaves) {
+            timeRecieved[slave] = true;
+            if(!pixelsRecieved[slave]) {
+                transferring++;
+            }
+        } else {
+            pixelsRecieved[slave] = true;
+            if(timeRecieved[slave]) {
+                transferring--;
+            }
+
+            if(toneMapping) {
+                int channels = quantized[slave].size();
+                unpacked.resize(channels);
+                decodePixels(WIRE_FORMAT_BYTE, quantized[slave].data(), channels, unpacked.data());
+                copyTypedPixels(unpacked.data(), channels, &(pixels[offsets[slave + 1]]), types[slave + 1], true);
+            }
+        }
+    }
+
+    double computationTime = 0.0;
+    for(int i = 0; i < slaves; i++) {
+        computationTime += slaveTimes[i];
+    }
+
+    return computationTime;
+}
+
+// Prints where the gather time of the static modes went
+static void printGatherTimes(GatherTimes* times) {
+    if(renderOptions.stats) {
+        std::cout << "Wait for Slowest Time: " << times->waitTime << " seconds" << std::endl;
+        std::cout << "Transfer Time: " << times->transferTime << " seconds" << std::endl;
+    }
+}
+
+// Creates a datatype for the rows of the image that a rank renders in
+// cyclical rows mode. Receive with it at the address of the image.
+static MPI_Datatype createCyclesType(ConfigData* data, int rank) {
+    std::vector<int> lengths;
+    std::vector<int> displacements;
+
+    // One block per cycle, the last one may be cut short
+    for(int y = rank * data->cycleSize; y < data->height; y += data->cycleSize * data->mpi_procs) {
+        int height = data->cycleSize;
+        if(y + height >= data->height) {
+            height = data->height - y;
+        }
+
+        lengths.push_back(3 * data->width * height);
+        displacements.push_back(3 * data->width * y);
+    }
+
+    MPI_Datatype cyclesType;
+    MPI_Type_indexed(lengths.size(), lengths.data(), displacements.data(), MPI_FLOAT, &cyclesType);
+    MPI_Type_commit(&cyclesType);
+    return cyclesType;
+}
+
+// Creates a datatype for the columns of the image that a rank renders in
+// cyclical columns mode, row by row, in the order the rank packs them.
+// Receive with it at the address of the image.
+static MPI_Datatype createColumnCyclesType(ConfigData* data, int rank) {
+    std::vector<int> lengths;
+    std::vector<int> displacements;
+
+    // One block per cycle in a row, the last one may be cut short
+    for(int x = rank * data->cycleSize; x < data->width; x += data->cycleSize * data->mpi_procs) {
+        int width = data->cycleSize;
+        if(x + width >= data->width) {
+            width = data->width - x;
+        }
+
+        lengths.push_back(3 * width);
+        displacements.push_back(3 * x);
+    }
+
+    // One row of it, stretched to a whole image row so the rows repeat
+    MPI_Datatype rowType;
+    MPI_Type_indexed(lengths.size(), lengths.data(), displacements.data(), MPI_FLOAT, &rowType);
+
+    MPI_Datatype imageRowType;
+    MPI_Type_create_resized(rowType, 0, 3 * data->width * sizeof(float), &imageRowType);
+    MPI_Type_free(&rowType);
+
+    MPI_Datatype cyclesType;
+    MPI_Type_contiguous(data->height, imageRowType, &cyclesType);
+    MPI_Type_commit(&cyclesType);
+    MPI_Type_free(&imageRowType);
+    return cyclesType;
+}
 
 void masterMain(ConfigData* data)
 {
@@ -16,7 +234,42 @@ void masterMain(ConfigData* data)
     //schemes that returns some values that you need to handle.
     
     //Allocate space for the image on the master.
-    float* pixels = new float[3 * data->width * data->height];
+    //Streamed images are written out as they come in instead.
+    float* pixels = NULL;
+    ImageStream stream;
+
+    //Named once, so previews and the streamed or saved image match.
+    std::string file = "renders/" + generateFileName();
+
+    bool streaming = renderOptions.streamOutput
+        && (data->partitioningMode == PART_MODE_DYNAMIC || data->partitioningMode == PART_MODE_DYNAMIC_HIERARCHICAL);
+    if(renderOptions.streamOutput && !streaming) {
+        std::cout << "-stream requires dynamic partitioning, the image will be saved at the end." << std::endl;
+    }
+
+    if(renderOptions.sharedImage && !usesSharedImage(data)) {
+        std::cout << "-shm requires static strips, blocks or cycles partitioning, it will be ignored." << std::endl;
+    }
+
+    if(renderOptions.toneMap != TONE_MAP_NONE && !usesToneMapping(data)) {
+        std::cout << "-tm requires static partitioning without -shm, it will be ignored." << std::endl;
+    }
+
+    if(renderOptions.progressive && !usesProgressive(data)) {
+        std::cout << "-progressive requires dynamic partitioning without -stream, it will be ignored." << std::endl;
+    }
+
+    if(streaming) {
+        streaming = !openImageStream(&stream, file, data);
+    }
+
+    // With -shm the image is the one shared by our node
+    bool sharing = usesSharedImage(data);
+    SharedImage image;
+
+    if(!streaming && !sharing) {
+        pixels = new float[3 * data->width * data->height];
+    }
     
     //Execution time will be defined as how long it takes
     //for the given function to execute based on partitioning
@@ -31,43 +284,81 @@ void masterMain(ConfigData* data)
 	//called.
 	//It is suggested that you use the same parameters to your functions as shown
 	//in the sequential example below.
-    switch (data->partitioningMode)
-    {
-        case PART_MODE_NONE:
-            //Call the function that will handle this.
-            startTime = MPI_Wtime();
-            masterSequential(data, pixels);
-            stopTime = MPI_Wtime();
-            break;
+    if(sharing) {
+        //The static modes sharing an image all render it the same way.
+        startTime = MPI_Wtime();
+        masterStaticSharedImage(data, &image);
+        stopTime = MPI_Wtime();
+    } else {
+        //Compared as an int, since common.h adds modes that PartType lacks.
+        switch ((int) data->partitioningMode)
+        {
+            case PART_MODE_NONE:
+                //Call the function that will handle this.
+                startTime = MPI_Wtime();
+                masterSequential(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
         
-        case PART_MODE_STATIC_STRIPS_VERTICAL:
-            startTime = MPI_Wtime();
-            masterStaticContinuousColumns(data, pixels);
-            stopTime = MPI_Wtime();
-            break;
+            case PART_MODE_STATIC_STRIPS_HORIZONTAL:
+                startTime = MPI_Wtime();
+                masterStaticContinuousRows(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
+
+            case PART_MODE_STATIC_STRIPS_VERTICAL:
+                startTime = MPI_Wtime();
+                masterStaticContinuousColumns(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
         
-        case PART_MODE_STATIC_CYCLES_HORIZONTAL:
-            startTime = MPI_Wtime();
-            masterStaticCyclicalRows(data, pixels);
-            stopTime = MPI_Wtime();
-            break;
+            case PART_MODE_STATIC_CYCLES_HORIZONTAL:
+                startTime = MPI_Wtime();
+                masterStaticCyclicalRows(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
+
+            case PART_MODE_STATIC_CYCLES_VERTICAL:
+                startTime = MPI_Wtime();
+                masterStaticCyclicalColumns(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
         
-        case PART_MODE_DYNAMIC:
-            startTime = MPI_Wtime();
-            masterDynamicCentralizedQueue(data, pixels);
-            stopTime = MPI_Wtime();
-            break;
+            case PART_MODE_DYNAMIC:
+                startTime = MPI_Wtime();
+                masterDynamicCentralizedQueue(data, pixels, streaming ? &stream : NULL, file);
+                stopTime = MPI_Wtime();
+                break;
+
+            case PART_MODE_DYNAMIC_HIERARCHICAL:
+                startTime = MPI_Wtime();
+                masterDynamicHierarchical(data, pixels, streaming ? &stream : NULL);
+                stopTime = MPI_Wtime();
+                break;
             
-        case PART_MODE_STATIC_BLOCKS:
-            startTime = MPI_Wtime();
-            masterStaticSquareBlocks(data, pixels);
-            stopTime = MPI_Wtime();
-            break;
-
-        default:
-            std::cout << "This mode (" << data->partitioningMode;
-            std::cout << ") is not currently implemented." << std::endl;
-            break;
+            case PART_MODE_STATIC_BLOCKS:
+                startTime = MPI_Wtime();
+                masterStaticSquareBlocks(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
+
+            case PART_MODE_STATIC_COST_BLOCKS:
+                startTime = MPI_Wtime();
+                masterStaticCostBlocks(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
+
+            case PART_MODE_WORK_STEALING:
+                startTime = MPI_Wtime();
+                masterDistributedWorkStealing(data, pixels);
+                stopTime = MPI_Wtime();
+                break;
+
+            default:
+                std::cout << "This mode (" << data->partitioningMode;
+                std::cout << ") is not currently implemented." << std::endl;
+                break;
+        }
     }
 
     renderTime = stopTime - startTime;
@@ -75,11 +366,21 @@ void masterMain(ConfigData* data)
 
     //After this gets done, save the image.
     std::cout << "Image will be save to: ";
-    std::string file = "renders/" + generateFileName();
-    std::cout << file << std::endl;
-    savePixels(file, pixels, data);
+    if(streaming) {
+        // Already written, apart from the end of the file
+        std::cout << file << std::endl;
+        if(closeImageStream(&stream)) {
+            std::cout << "ERROR: The streamed image could not be saved." << std::endl;
+        }
+    } else {
+        std::cout << file << std::endl;
+        savePixels(file, sharing ? image.pixels : pixels, data);
+    }
 
     //Delete the pixel data.
+    if(sharing) {
+        closeSharedImage(&image);
+    }
     delete[] pixels; 
 }
 
@@ -88,19 +389,39 @@ void masterSequential(ConfigData* data, float* pixels)
     //Start the computation time timer.
     double computationStart = MPI_Wtime();
 
-    //Render the scene.
-    for( int i = 0; i < data->height; ++i )
+    if( renderOptions.threads > 1 )
     {
-        for( int j = 0; j < data->width; ++j )
+        //Render the scene as tiles shared by the threads, as raytrace_seq
+        //does. Every pixel is shaded exactly as in the loop below.
+        RenderRegion region;
+        region.xInImage = 0;
+        region.yInImage = 0;
+        region.xInPixels = 0;
+        region.yInPixels = 0;
+        region.width = data->width;
+        region.height = data->height;
+        region.pixelsWidth = data->width;
+        region.pixelsHeight = data->height;
+        region.pixels = pixels;
+
+        renderRegion(data, &region);
+    }
+    else
+    {
+        //Render the scene.
+        for( int i = 0; i < data->height; ++i )
         {
-            int row = i;
-            int column = j;
+            for( int j = 0; j < data->width; ++j )
+            {
+                int row = i;
+                int column = j;
 
-            //Calculate the index into the array.
-            int baseIndex = 3 * ( row * data->width + column );
+                //Calculate the index into the array.
+                int baseIndex = 3 * ( row * data->width + column );
 
-            //Call the function to shade the pixel.
-            shadePixel(&(pixels[baseIndex]),row,j,data);
+                //Call the function to shade the pixel.
+                shadePixel(&(pixels[baseIndex]),row,j,data);
+            }
         }
     }
 
@@ -122,8 +443,6 @@ void masterSequential(ConfigData* data, float* pixels)
 }
 
 void masterStaticContinuousColumns(ConfigData* data, float* pixels) {
-    MPI_Status status;
-
     //Start computation timer.
     double computationStart = MPI_Wtime();
 
@@ -153,11 +472,10 @@ void masterStaticContinuousColumns(ConfigData* data, float* pixels) {
     // Start communication timer
     double communicationStart = MPI_Wtime();
     
-    // Recieve subregions
-    // Buffer with enough space for the largest subregion and the time report
-    float* recieveBuffer = new float[(3 * (subregionWidth + subregionRemainder) * data->height) + 1];
-    for(int i = 1; i < data->mpi_procs; i++) {
-        // Recieve data from slave
+    // Where each rank's subregion goes in the image
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs);
+    for(int i = 0; i < data->mpi_procs; i++) {
         int recieveWidth = subregionWidth;
 
         if(i == data->mpi_procs - 1) {
@@ -165,26 +483,21 @@ void masterStaticContinuousColumns(ConfigData* data, float* pixels) {
             recieveWidth += subregionRemainder;
         }
 
-        int recieveSize = (3 * recieveWidth * data->height) + 1;
-
-        MPI_Recv(recieveBuffer, recieveSize, MPI_FLOAT, i, 0, MPI_COMM_WORLD, &status);
-        
-        // Include slave computation time
-        computationTime += (double) recieveBuffer[recieveSize - 1];
-
         // Determine location in output
         int slaveXInImage = subregionWidth * i;
 
-        // Move into output buffer
-        // Move row-by-row as recieved region is much thinner than the image
-        for(int y = 0; y < data->height; y++) {
-            int pixelsRowOffset = 3 * (slaveXInImage + (y * data->width));
-            int recievedRowOffset = 3 * y * recieveWidth;
-            memcpy(&(pixels[pixelsRowOffset]), &(recieveBuffer[recievedRowOffset]), 3 * recieveWidth * sizeof(float));
-        }
+        types[i] = createImageBlockType(data, recieveWidth, data->height);
+        offsets[i] = 3 * slaveXInImage;
     }
 
-    delete[] recieveBuffer;
+    // Recieve subregions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
+
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
+    }
 
     // Stop communication timer
     double communicationStop = MPI_Wtime();
@@ -196,19 +509,15 @@ void masterStaticContinuousColumns(ConfigData* data, float* pixels) {
     std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
     double c2cRatio = communicationTime / computationTime;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+    printGatherTimes(&gatherTimes);
 }
 
-void masterStaticSquareBlocks(ConfigData* data, float* pixels) {
-    MPI_Status status;
-
+void masterStaticContinuousRows(ConfigData* data, float* pixels) {
     //Start computation timer.
     double computationStart = MPI_Wtime();
 
-    int subregionWidth = data->width / ((int)sqrt(data->mpi_procs));
-    int subregionWidthRemainder = data->width % ((int)sqrt(data->mpi_procs));
-    
-    int subregionHeight = data->height / ((int)sqrt(data->mpi_procs));
-    int subregionHeightRemainder = data->height % ((int)sqrt(data->mpi_procs));
+    int subregionHeight = data->height / data->mpi_procs;
+    int subregionRemainder = data->height % data->mpi_procs;
 
     // Compute our portion of the region
     // Describe our region
@@ -217,14 +526,13 @@ void masterStaticSquareBlocks(ConfigData* data, float* pixels) {
     region.yInImage = 0;
     region.xInPixels = 0;
     region.yInPixels = 0;
-    region.width = subregionWidth;
+    region.width = data->width;
     region.height = subregionHeight;
-    region.pixelsWidth = region.width;
-    region.pixelsHeight = region.height;
-
+    region.pixelsWidth = data->width;
+    region.pixelsHeight = data->height;
     region.pixels = pixels;
 
-    // Render our region
+    // Render our subregion
     renderRegion(data, &region);
 
     // Stop computation timer
@@ -233,38 +541,34 @@ void masterStaticSquareBlocks(ConfigData* data, float* pixels) {
 
     // Start communication timer
     double communicationStart = MPI_Wtime();
-    
-    // Recieve subregions
-    // Buffer with enough space for the largest subregion and the time report
-    float* recieveBuffer = new float[(3 * (subregionWidth + subregionWidthRemainder) * (subregionHeight + subregionHeightRemainder)) + 1];
-    for(int i = 1; i < data->mpi_procs; i++) {
-        // Recieve data from slave
-        int recieveWidth = subregionWidth;
+
+    // Where each rank's subregion goes in the image. Whole rows are
+    // contiguous in the image, just like in the slave's buffer.
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs);
+    for(int i = 0; i < data->mpi_procs; i++) {
         int recieveHeight = subregionHeight;
 
         if(i == data->mpi_procs - 1) {
             // Last slave has remainder as well
-            recieveWidth += subregionWidthRemainder;
-            recieveHeight += subregionHeightRemainder;
+            recieveHeight += subregionRemainder;
         }
 
-        int recieveSize = (3 * recieveWidth * recieveHeight) + 1;
+        // Determine location in output
+        int slaveYInImage = subregionHeight * i;
 
-        MPI_Recv(recieveBuffer, recieveSize, MPI_FLOAT, i, 0, MPI_COMM_WORLD, &status);
-        
-        // Include slave computation time
-        computationTime += (double) recieveBuffer[recieveSize - 1];
+        MPI_Type_contiguous(3 * data->width * recieveHeight, MPI_FLOAT, &(types[i]));
+        MPI_Type_commit(&(types[i]));
+        offsets[i] = 3 * data->width * slaveYInImage;
+    }
 
-        // Determine location in output
-        int slaveXInImage = subregionWidth * (i % (int)sqrt(data->mpi_procs));
-        int slaveYInImage = subregionHeight * (i / (int)sqrt(data->mpi_procs));
-
-        // Move into output buffer
-        for(int y = 0; y < recieveHeight; y++) {
-            int pixelsRowOffset = 3 * (slaveXInImage + ((y + slaveYInImage) * data->width));
-            int recievedRowOffset = 3 * y * recieveWidth;
-            memcpy(&(pixels[pixelsRowOffset]), &(recieveBuffer[recievedRowOffset]), 3 * recieveWidth * sizeof(float));
-        }
+    // Recieve subregions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
+
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
     }
 
     // Stop communication timer
@@ -277,11 +581,67 @@ void masterStaticSquareBlocks(ConfigData* data, float* pixels) {
     std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
     double c2cRatio = communicationTime / computationTime;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+    printGatherTimes(&gatherTimes);
 }
 
-void masterStaticCyclicalRows(ConfigData* data, float* pixels) {
-    MPI_Status status;
+void masterStaticSquareBlocks(ConfigData* data, float* pixels) {
+    //Start computation timer.
+    double computationStart = MPI_Wtime();
+
+    // Compute our portion of the region
+    // Describe our region, the first block of the grid of processes
+    RenderRegion region;
+    getBlockBounds(data, 0, &region.xInImage, &region.yInImage, &region.width, &region.height);
+    region.xInPixels = region.xInImage;
+    region.yInPixels = region.yInImage;
+    region.pixelsWidth = data->width;
+    region.pixelsHeight = data->height;
+    region.pixels = pixels;
+
+    // Render our region
+    renderRegion(data, &region);
 
+    // Stop computation timer
+    double computationStop = MPI_Wtime();
+    double computationTime = computationStop - computationStart;
+
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
+    
+    // Where each rank's subregion goes in the image
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs);
+    for(int i = 0; i < data->mpi_procs; i++) {
+        int recieveX, recieveY, recieveWidth, recieveHeight;
+        getBlockBounds(data, i, &recieveX, &recieveY, &recieveWidth, &recieveHeight);
+
+        types[i] = createImageBlockType(data, recieveWidth, recieveHeight);
+        offsets[i] = 3 * (recieveX + (recieveY * data->width));
+    }
+
+    // Recieve subregions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
+
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
+    }
+
+    // Stop communication timer
+    double communicationStop = MPI_Wtime();
+    double communicationTime = communicationStop - communicationStart;
+
+    // Print times & c-to-c ratio
+    // Copied from given sequential code
+    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
+    double c2cRatio = communicationTime / computationTime;
+    std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+    printGatherTimes(&gatherTimes);
+}
+
+void masterStaticCyclicalRows(ConfigData* data, float* pixels) {
     //Start computation timer.
     double computationStart = MPI_Wtime();
 
@@ -319,65 +679,139 @@ void masterStaticCyclicalRows(ConfigData* data, float* pixels) {
     // Start communication timer
     double communicationStart = MPI_Wtime();
     
-    // Recieve subregions
-    int totalSubregions = (data->height / data->cycleSize) + ((data->height % data->cycleSize != 0) ? 1 : 0);
-    int maxSubregions = (totalSubregions / data->mpi_procs) + 1;
-    int slaveRegionHeight = maxSubregions * data->cycleSize;
-    int slaveRegionSize = (3 * data->width * slaveRegionHeight) + 1;
-
-    float** slaveRegions = new float*[data->mpi_procs - 1];
+    // Where each rank's rows go in the image
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs, 0);
+    for(int i = 0; i < data->mpi_procs; i++) {
+        types[i] = createCyclesType(data, i);
+    }
 
-    // Recieve each set of regions
-    for(int i = 1; i < data->mpi_procs; i++) {
-        slaveRegions[i - 1] = new float[slaveRegionSize];
-        MPI_Recv(slaveRegions[i - 1], slaveRegionSize, MPI_FLOAT, i, 0, MPI_COMM_WORLD, &status);
+    // Recieve each set of regions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
 
-        // Include slave computation time
-        computationTime += (double) slaveRegions[i - 1][slaveRegionSize - 1];
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
     }
 
-    // Move regions into image
-    int subregionNumber = 1;
-    int imageStartY = data->cycleSize;
-    int slaveStartY = 0;
+    // Stop communication timer
+    double communicationStop = MPI_Wtime();
+    double communicationTime = communicationStop - communicationStart;
 
-    while(imageStartY < data->height) {
-        // Where are we getting data from
-        int rank = subregionNumber % data->mpi_procs;
+    // Print times & c-to-c ratio
+    // Copied from given sequential code
+    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
+    double c2cRatio = communicationTime / computationTime;
+    std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+    printGatherTimes(&gatherTimes);
+}
 
-        if(rank == 0) {
-            // Us. No copy
-            slaveStartY += data->cycleSize;
-            imageStartY += data->cycleSize;
-            subregionNumber++;
-            continue;
-        }
+void masterStaticCyclicalColumns(ConfigData* data, float* pixels) {
+    //Start computation timer.
+    double computationStart = MPI_Wtime();
 
-        // Slave. Copy
-        int imageIndex = 3 * data->width * imageStartY;
-        int slaveIndex = 3 * data->width * slaveStartY;
-        int height = data->cycleSize;
+    // Compute our portion of the region
+    // Describe our region
+    RenderRegion region;
+    region.xInImage = 0;
+    region.yInImage = 0;
+    region.xInPixels = 0;
+    region.yInPixels = 0;
+    region.width = data->cycleSize;
+    region.height = data->height;
+    region.pixelsWidth = data->width;
+    region.pixelsHeight = data->height;
+    region.pixels = pixels;
 
-        // Don't overrun
-        if(imageStartY + height >= data->height) {
-            height = data->height - imageStartY;
+    // Render our region
+    while(region.xInImage < data->width) {
+        // Make sure we don't overrun
+        if(region.xInImage + data->cycleSize >= data->width) {
+            region.width = data->width - region.xInImage;
         }
 
-        int copySize = 3 * data->width * height * sizeof(float);
+        // Render subregion
+        renderRegion(data, &region);
+
+        region.xInImage += data->cycleSize * data->mpi_procs;
+        region.xInPixels += data->cycleSize * data->mpi_procs;
+    }
+
+    // Stop computation timer
+    double computationStop = MPI_Wtime();
+    double computationTime = computationStop - computationStart;
 
-        float* slaveRegion = slaveRegions[rank - 1];
-        memcpy(&(pixels[imageIndex]), &(slaveRegion[slaveIndex]), copySize);
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
 
-        imageStartY += data->cycleSize;
-        subregionNumber++;
+    // Where each rank's columns go in the image
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs, 0);
+    for(int i = 0; i < data->mpi_procs; i++) {
+        types[i] = createColumnCyclesType(data, i);
     }
 
-    // Clean up
-    for(int i = 0; i < data->mpi_procs - 1; i++) {
-        delete[] slaveRegions[i];
+    // Recieve each set of regions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
+
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
     }
 
-    delete[] slaveRegions;
+    // Stop communication timer
+    double communicationStop = MPI_Wtime();
+    double communicationTime = communicationStop - communicationStart;
+
+    // Print times & c-to-c ratio
+    // Copied from given sequential code
+    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
+    double c2cRatio = communicationTime / computationTime;
+    std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+    printGatherTimes(&gatherTimes);
+}
+
+void masterStaticSharedImage(ConfigData* data, SharedImage* image) {
+    openSharedImage(data, image);
+
+    // Render our part straight into our node's image
+    double computationTime = renderSharedImage(data, image);
+
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
+
+    // Once the rest of our node is done, their parts are already in place
+    syncSharedImage(image);
+
+    // Every other node sends its part from its own copy of the image
+    std::vector<int> nodes(image->leaders);
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    nodes.erase(nodes.begin());
+
+    std::vector<MPI_Datatype> types(nodes.size());
+    std::vector<MPI_Request> requests(nodes.size());
+    long long bytesRecieved = 0;
+    for(size_t i = 0; i < nodes.size(); i++) {
+        types[i] = createNodeImageType(data, image, nodes[i]);
+        MPI_Irecv(image->pixels, 1, types[i], nodes[i], 0, MPI_COMM_WORLD, &(requests[i]));
+
+        int size;
+        MPI_Type_size(types[i], &size);
+        bytesRecieved += size;
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    for(size_t i = 0; i < nodes.size(); i++) {
+        MPI_Type_free(&(types[i]));
+    }
+
+    // Slave computation time
+    MPI_Reduce(MPI_IN_PLACE, &computationTime, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 
     // Stop communication timer
     double communicationStop = MPI_Wtime();
@@ -389,125 +823,673 @@ void masterStaticCyclicalRows(ConfigData* data, float* pixels) {
     std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
     double c2cRatio = communicationTime / computationTime;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+
+    if(renderOptions.stats) {
+        std::cout << "Node Images Recieved: " << nodes.size() << std::endl;
+        std::cout << "Image Bytes Recieved: " << bytesRecieved << std::endl;
+    }
 }
 
-void masterDynamicCentralizedQueue(ConfigData* data, float* pixels) {
+void masterStaticCostBlocks(ConfigData* data, float* pixels) {
+    // Estimate the cost of each part of the image, with everyone's help
+    double estimateStart = MPI_Wtime();
+
+    CostMap map;
+    double samplingTime = buildCostMap(data, &map);
+
+    int* rects = new int[4 * data->mpi_procs];
+    partitionByCost(data, &map, rects);
+    freeCostMap(&map);
+
+    double estimateTime = MPI_Wtime() - estimateStart;
+
+    //Start computation timer.
+    double computationStart = MPI_Wtime();
+
+    // Compute our portion of the region
+    // Describe our region
+    RenderRegion region;
+    region.xInImage = rects[0];
+    region.yInImage = rects[1];
+    region.xInPixels = rects[0];
+    region.yInPixels = rects[1];
+    region.width = rects[2];
+    region.height = rects[3];
+    region.pixelsWidth = data->width;
+    region.pixelsHeight = data->height;
+    region.pixels = pixels;
+
+    // Render our region
+    renderRegion(data, &region);
+
+    // Stop computation timer
+    double computationStop = MPI_Wtime();
+    double computationTime = samplingTime + (computationStop - computationStart);
+
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
+
+    // Where each rank's subregion goes in the image
+    std::vector<MPI_Datatype> types(data->mpi_procs);
+    std::vector<int> offsets(data->mpi_procs);
+    for(int i = 0; i < data->mpi_procs; i++) {
+        int recieveX = rects[(4 * i) + 0];
+        int recieveY = rects[(4 * i) + 1];
+        int recieveWidth = rects[(4 * i) + 2];
+        int recieveHeight = rects[(4 * i) + 3];
+
+        types[i] = createImageBlockType(data, recieveWidth, recieveHeight);
+        offsets[i] = 3 * (recieveX + (recieveY * data->width));
+    }
+
+    // Recieve subregions straight into the image, including slave
+    // computation time
+    GatherTimes gatherTimes;
+    computationTime += gatherStaticResults(data, pixels, types.data(), offsets.data(), &gatherTimes);
+
+    for(int i = 0; i < data->mpi_procs; i++) {
+        MPI_Type_free(&(types[i]));
+    }
+
+    delete[] rects;
+
+    // Stop communication timer
+    double communicationStop = MPI_Wtime();
+    double communicationTime = (estimateTime - samplingTime) + (communicationStop - communicationStart);
+
+    // Print times & c-to-c ratio
+    // Copied from given sequential code
+    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
+    double c2cRatio = communicationTime / computationTime;
+    std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+
+    if(renderOptions.stats) {
+        std::cout << "Cost Estimation Time: " << estimateTime << " seconds" << std::endl;
+    }
+    printGatherTimes(&gatherTimes);
+}
+
+// Where the tiles of dynamic mode are recieved
+typedef struct {
+    // Header of the tile each worker is sending
+    TileHeader* headers;
+    MPI_Datatype headerType;
+
+    // Each worker's tile in the wire format, or NULL to recieve float
+    // pixels straight into the image
+    unsigned char* tileBuffers;
+    int tileBufferSize;
+
+    // Progressive pass whose pixels the tiles hold, packed together, or
+    // -1 for every pixel
+    int pass;
+} TileDestinations;
+
+// Starts recieving a worker's tile of dynamic mode, given as x, y, width,
+// height
+static void recieveTile(ConfigData* data, float* pixels, TileDestinations* destinations, int* tile, int w, MPI_Comm comm, MPI_Datatype* resultsTypes, MPI_Request* resultsRequests) {
+    int width = tile[2];
+    int height = tile[3];
+    int tilePixels = width * height;
+    if(destinations->pass >= 0) {
+        tilePixels = countPassPixels(tile[0], tile[1], width, height, destinations->pass);
+    }
+
+    MPI_Datatype pixelsType;
+    void* destination;
+    if(destinations->tileBuffers != NULL) {
+        MPI_Type_contiguous(3 * tilePixels, wireChannelType(renderOptions.wireFormat), &pixelsType);
+        MPI_Type_commit(&pixelsType);
+        destination = &(destinations->tileBuffers[destinations->tileBufferSize * w]);
+    } else {
+        pixelsType = createImageBlockType(data, width, height);
+        destination = &(pixels[3 * ((tile[1] * data->width) + tile[0])]);
+    }
+
+    resultsTypes[w] = createTileMessageType(destinations->headerType, &(destinations->headers[w]), pixelsType, destination);
+    MPI_Type_free(&pixelsType);
+
+    MPI_Irecv(MPI_BOTTOM, 1, resultsTypes[w], w + 1, 0, comm, &(resultsRequests[w]));
+}
+
+// What guided scheduling has learnt about the render so far
+typedef struct {
+    // Rendering time and size of every tile recieved so far
+    double renderTime;
+    long long renderedPixels;
+
+    // Time the master has spent handling those tiles once they arrived
+    double handlingTime;
+    int handledTiles;
+} GuidedTimes;
+
+// Gets the number of -bw by -bh tiles to hand out in the next work packet
+static int getPacketTiles(ConfigData* data, TileSequence* sequence, GuidedTimes* times, int workers) {
+    if(!renderOptions.guided) {
+        return 1;
+    }
+
+    // Shrink with the work left, like OpenMP's guided schedule, so the
+    // last packets are small enough to even out the finish
+    int remaining = countRemainingTiles(sequence);
+    int count = (remaining + (2 * workers) - 1) / (2 * workers);
+
+    // But never so small that the workers finish them faster than the
+    // master can handle them
+    if(times->handledTiles > 0 && times->renderTime > 0.0) {
+        double tileTime = (times->renderTime / times->renderedPixels) * data->dynamicBlockWidth * data->dynamicBlockHeight;
+        double handlingTime = times->handlingTime / times->handledTiles;
+        count = std::max(count, (int) ceil((workers * handlingTime) / tileTime));
+    }
+
+    return std::max(std::min(count, getMaxPacketTiles(data)), 1);
+}
+
+// Sizes the chunks that the hierarchical mode hands to sub-masters
+typedef struct {
+    // Workers under each sub-master
+    int* nodeWorkers;
+
+    // Most tiles in a chunk
+    int maxTiles;
+
+    // Chunks each sub-master may have outstanding, so its workers can
+    // start on the next while the last tiles of one are finishing
+    int window;
+} ChunkSizing;
+
+// Gets the number of tiles in the next chunk for sub-master w. Chunks
+// shrink like guided packets, but always hold enough tiles to keep every
+// worker of the sub-master busy.
+static int getChunkTiles(TileSequence* sequence, ChunkSizing* chunks, int w, int subMasters) {
+    int remaining = countRemainingTiles(sequence);
+    int count = (remaining + (2 * subMasters) - 1) / (2 * subMasters);
+    int minimum = 2 * renderOptions.dynamicWindow * std::max(chunks->nodeWorkers[w], 1);
+
+    return std::max(std::min(std::max(count, minimum), chunks->maxTiles), 1);
+}
+
+// Totals of every run of the dynamic queue in a render
+typedef struct {
+    double computationTime;
+    double communicationTime;
+    double idleTime;
+
+    // For -stats
+    long long bytesRecieved;
+    int packetsSent;
+
+    // Messages exchanged with the workers
+    long long messages;
+} QueueTotals;
+
+// Runs the queue of dynamic mode with the other ranks of comm as its
+// workers. Without chunks every packet is a tile, or a guided packet;
+// with them the workers are sub-masters, and every packet is a chunk.
+// With a pass of 0 or more, only the pixels of that progressive pass are
+// rendered. Adds the times and counts of the run to totals.
+static void runDynamicQueue(ConfigData* data, float* pixels, ImageStream* stream, MPI_Comm comm, ChunkSizing* chunks, int pass, QueueTotals* totals) {
     MPI_Status status;
     double computationTime = 0.0;
+    double idleTime = 0.0;
     double communicationStart = MPI_Wtime();
 
     /*
-     * 1.   Distribute initial work
-     * 2.   Recv from MPI_ANY_SOURCE a results packet, consisting (width * height) + 3 floats:
-     *          data_array, x, y, time
-     * 3.   Send to the rank we got the packet from a work packet, consisting of 2 ints:
-     *          x, y
-     *      If no work is remaining, -1 -1 is sent and the rank is marked as done
-     * 4.   Copy recieved packet data into image
-     * 5.   If any ranks are not done, continue from 2.
+     * 1.   Distribute initial work, up to window work packets per worker,
+     *      each consisting of 4 ints:
+     *          x, y, width, height
+     *      Tiles are handed out along the -to order, from each worker's
+     *      own run of tiles with -ta. With -guided a packet is a rectangle
+     *      of several tiles, sized by getPacketTiles(). Sub-masters get
+     *      chunks sized by getChunkTiles() instead.
+     * 2.   Wait for a tile from any worker. Each tile is a header with its
+     *      region and timings, followed by its pixels in the wire format.
+     *      Workers render their tiles in the order they were sent, so
+     *      float pixels are recieved straight into their place in the
+     *      image. Other formats, and tiles of a streamed image, are
+     *      recieved into a buffer for the worker and converted from there.
+     * 3.   Send that worker a new work packet, if any work is remaining,
+     *      so it always has work queued up behind the tile it is rendering
+     * 4.   Once a worker has no tiles outstanding, send it -1 -1 -1 -1 and
+     *      mark it as done
+     * 5.   If any workers are not done, continue from 2.
+     * 6.   Recieve the last header of each worker, with no pixels, holding
+     *      the time it was idle after its last tile
      */
 
-    int resultsSize = (3 * data->dynamicBlockWidth * data->dynamicBlockHeight) + 3;
-    float* resultsPacket = new float[resultsSize];
+    int commSize;
+    MPI_Comm_size(comm, &commSize);
+    int workers = commSize - 1;
+    int window = chunks != NULL ? chunks->window : renderOptions.dynamicWindow;
+    WireFormat format = renderOptions.wireFormat;
+
+    MPI_Request* resultsRequests = new MPI_Request[workers];
+    MPI_Datatype* resultsTypes = new MPI_Datatype[workers];
+
+    TileDestinations destinations;
+    destinations.headers = new TileHeader[workers];
+    destinations.headerType = createTileHeaderType();
+    destinations.tileBuffers = NULL;
+    destinations.pass = pass;
+    int maxPacketTiles = chunks != NULL ? chunks->maxTiles : getMaxPacketTiles(data);
+    int packetPixels = maxPacketTiles * data->dynamicBlockWidth * data->dynamicBlockHeight;
+    destinations.tileBufferSize = 3 * packetPixels * wireChannelSize(format);
+
+    float* tilePixels = NULL;
+    if(stream != NULL || format != WIRE_FORMAT_FLOAT || pass >= 0) {
+        destinations.tileBuffers = new unsigned char[destinations.tileBufferSize * workers];
+        tilePixels = new float[3 * packetPixels];
+    }
+
+    // Size of every tile message, for -stats
+    long long bytesRecieved = 0;
+    int packetsSent = 0;
+    long long messages = 0;
+
+    // Tiles sent to each worker and not yet recieved, oldest first
+    int* outstandingTiles = new int[4 * window * workers];
+    int* outstandingHead = new int[workers];
+    int* outstanding = new int[workers];
+
+    // Tiles in the order they are handed out. Guided packets and chunks
+    // are runs of tiles in raster order, so they form rectangles.
+    TileOrder order = renderOptions.tileOrder;
+    if((renderOptions.guided || chunks != NULL) && order != TILE_ORDER_RASTER) {
+        std::cout << "Packets of several tiles are handed out in raster order, -to will be ignored." << std::endl;
+        order = TILE_ORDER_RASTER;
+    }
+
+    // A streamed image can only write rows once they are complete, so
+    // tiles go out in raster order or the stream holds most of the image
+    bool affinity = renderOptions.tileAffinity;
+    if(stream != NULL && (order != TILE_ORDER_RASTER || affinity)) {
+        std::cout << "Streamed images are handed out in raster order, -to and -ta will be ignored." << std::endl;
+        order = TILE_ORDER_RASTER;
+        affinity = false;
+    }
+
+    TileSequence sequence;
+    buildTileSequence(data, order, affinity ? workers : 1, &sequence);
 
-    int* workPacket = new int[2];
+    GuidedTimes guidedTimes = { 0.0, 0, 0.0, 0 };
+
+    int* workPacket = new int[4];
     workPacket[0] = 0;  // x
     workPacket[1] = 0;  // y
+    workPacket[2] = 0;  // width
+    workPacket[3] = 0;  // height
+
+    int donePacket[4] = { -1, -1, -1, -1 };
 
     // Distribute initial work
-    for(int i = 1; i < data->mpi_procs; i++) {
-        MPI_Send(workPacket, 2, MPI_INT, i, 0, MPI_COMM_WORLD);
-        incrementWorkPacket(data, workPacket);
+    for(int w = 0; w < workers; w++) {
+        outstandingHead[w] = 0;
+        outstanding[w] = 0;
     }
 
-    // Work-sending loop
-    while(workPacket[0] != -1) {
-        // Recieve results packet
-        MPI_Recv(resultsPacket, resultsSize, MPI_FLOAT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-
-        // Send new work
-        MPI_Send(workPacket, 2, MPI_INT, status.MPI_SOURCE, 0, MPI_COMM_WORLD);
+    for(int i = 0; i < window; i++) {
+        for(int w = 0; w < workers; w++) {
+            int tiles = chunks != NULL ? getChunkTiles(&sequence, chunks, w, workers) : getPacketTiles(data, &sequence, &guidedTimes, workers);
+            nextWorkPacket(data, &sequence, w, tiles, workPacket);
+            if(workPacket[0] == -1) {
+                break;
+            }
 
-        // Copy into image
-        int imageX = (int) resultsPacket[resultsSize - 3];
-        int imageY = (int) resultsPacket[resultsSize - 2];
-        computationTime += (double) resultsPacket[resultsSize - 1];
+            MPI_Send(workPacket, 4, MPI_INT, w + 1, 0, comm);
+            packetsSent++;
 
-        int copyWidth = data->dynamicBlockWidth;
-        if(imageX + copyWidth >= data->width) {
-            copyWidth = data->width - imageX;
+            memcpy(&(outstandingTiles[4 * ((w * window) + i)]), workPacket, 4 * sizeof(int));
+            outstanding[w]++;
         }
+    }
 
-        // Copy each row
-        for(int resultsY = 0; resultsY < data->dynamicBlockHeight && imageY < data->height; resultsY++, imageY++) {
-            int resultsOffset = 3 * resultsY * data->dynamicBlockWidth;
-            int pixelsOffset = 3 * ((imageY * data->width) + imageX);
-
-            memcpy(&(pixels[pixelsOffset]), &(resultsPacket[resultsOffset]), 3 * copyWidth * sizeof(float));
+    // Start listening for results
+    int activeWorkers = 0;
+    for(int w = 0; w < workers; w++) {
+        if(outstanding[w] > 0) {
+            int* tile = &(outstandingTiles[4 * (w * window)]);
+            recieveTile(data, pixels, &destinations, tile, w, comm, resultsTypes, resultsRequests);
+            activeWorkers++;
+        } else {
+            // More workers than tiles
+            MPI_Send(donePacket, 4, MPI_INT, w + 1, 0, comm);
+            resultsRequests[w] = MPI_REQUEST_NULL;
         }
-
-        incrementWorkPacket(data, workPacket);
     }
 
-    // Results-waiting loop
-    for(int i = 1; i < data->mpi_procs; i++) {
-        // Recieve results packet
-        MPI_Recv(resultsPacket, resultsSize, MPI_FLOAT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
+    // Work-sending loop
+    while(activeWorkers > 0) {
+        // Recieve results
+        int w;
+        MPI_Waitany(workers, resultsRequests, &w, &status);
+        double handlingStart = MPI_Wtime();
+
+        int messageSize;
+        MPI_Type_size(resultsTypes[w], &messageSize);
+        bytesRecieved += messageSize;
+        messages++;
+        MPI_Type_free(&(resultsTypes[w]));
+
+        TileHeader* header = &(destinations.headers[w]);
+        computationTime += header->computationTime;
+        idleTime += header->idleTime;
+
+        guidedTimes.renderTime += header->computationTime;
+        guidedTimes.renderedPixels += header->width * header->height;
+
+        if(destinations.tileBuffers != NULL) {
+            unsigned char* tileBuffer = &(destinations.tileBuffers[destinations.tileBufferSize * w]);
+
+            int tileChannels = 3 * header->width * header->height;
+            if(pass >= 0) {
+                tileChannels = 3 * countPassPixels(header->x, header->y, header->width, header->height, pass);
+            }
+
+            // Float tiles can be streamed as they are
+            float* tile = (float*) tileBuffer;
+            if(format != WIRE_FORMAT_FLOAT) {
+                decodePixels(format, tileBuffer, tileChannels, tilePixels);
+                tile = tilePixels;
+            }
+
+            if(pass >= 0) {
+                // Only this pass's pixels, packed together
+                unpackPassPixels(data, tile, header->x, header->y, header->width, header->height, pass, pixels);
+            } else if(stream != NULL) {
+                // Once the PNG has failed the tiles are dropped, but still
+                // recieved so the workers never block
+                streamPixels(stream, tile, header->x, header->y, header->width, header->height);
+            } else {
+                // Copy into the image a row at a time
+                for(int row = 0; row < header->height; row++) {
+                    memcpy(&(pixels[3 * (((header->y + row) * data->width) + header->x)]), &(tile[3 * row * header->width]), 3 * header->width * sizeof(float));
+                }
+            }
+        }
 
-        // Send termination packet
-        MPI_Send(workPacket, 2, MPI_INT, status.MPI_SOURCE, 0, MPI_COMM_WORLD);
+        outstandingHead[w] = (outstandingHead[w] + 1) % window;
+        outstanding[w]--;
 
-        // Copy into image
-        int imageX = (int) resultsPacket[resultsSize - 3];
-        int imageY = (int) resultsPacket[resultsSize - 2];
-        computationTime += (double) resultsPacket[resultsSize - 1];
+        // Send new work
+        int tiles = chunks != NULL ? getChunkTiles(&sequence, chunks, w, workers) : getPacketTiles(data, &sequence, &guidedTimes, workers);
+        nextWorkPacket(data, &sequence, w, tiles, workPacket);
+        if(workPacket[0] != -1) {
+            MPI_Send(workPacket, 4, MPI_INT, w + 1, 0, comm);
+            packetsSent++;
+
+            int tail = (outstandingHead[w] + outstanding[w]) % window;
+            memcpy(&(outstandingTiles[4 * ((w * window) + tail)]), workPacket, 4 * sizeof(int));
+            outstanding[w]++;
+        }
 
-        int copyWidth = data->dynamicBlockWidth;
-        if(imageX + copyWidth >= data->width) {
-            copyWidth = data->width - imageX;
+        if(outstanding[w] > 0) {
+            // Wait for its next tile
+            int* tile = &(outstandingTiles[4 * ((w * window) + outstandingHead[w])]);
+            recieveTile(data, pixels, &destinations, tile, w, comm, resultsTypes, resultsRequests);
+        } else {
+            // Send termination packet
+            MPI_Send(donePacket, 4, MPI_INT, w + 1, 0, comm);
+            activeWorkers--;
         }
 
-        // Copy each row
-        for(int resultsY = 0; resultsY < data->dynamicBlockHeight && imageY < data->height; resultsY++, imageY++) {
-            int resultsOffset = 3 * resultsY * data->dynamicBlockWidth;
-            int pixelsOffset = 3 * ((imageY * data->width) + imageX);
+        guidedTimes.handlingTime += MPI_Wtime() - handlingStart;
+        guidedTimes.handledTiles++;
+    }
 
-            memcpy(&(pixels[pixelsOffset]), &(resultsPacket[resultsOffset]), 3 * copyWidth * sizeof(float));
-        }
+    // Each worker reports how long it sat waiting after its last tile
+    for(int w = 0; w < workers; w++) {
+        TileHeader header;
+        MPI_Recv(&header, 1, destinations.headerType, w + 1, 0, comm, &status);
+        computationTime += header.computationTime;
+        idleTime += header.idleTime;
     }
 
     // Clean up
+    MPI_Type_free(&(destinations.headerType));
+    delete[] destinations.headers;
+    delete[] destinations.tileBuffers;
+    delete[] tilePixels;
     delete[] workPacket;
-    delete[] resultsPacket;
+    delete[] outstanding;
+    delete[] outstandingHead;
+    delete[] outstandingTiles;
+    delete[] resultsTypes;
+    delete[] resultsRequests;
 
     // Stop communication timer
     double communicationStop = MPI_Wtime();
     double communicationTime = communicationStop - communicationStart;
 
+    totals->computationTime += computationTime;
+    totals->communicationTime += communicationTime;
+    totals->idleTime += idleTime;
+    totals->bytesRecieved += bytesRecieved;
+    totals->packetsSent += packetsSent;
+
+    // Every packet, done packet and last header, and every tile recieved
+    totals->messages += messages + packetsSent + (2 * workers);
+}
+
+// Prints the times of the dynamic queue, and its statistics with -stats
+static void printQueueTotals(QueueTotals* totals, int window, ImageStream* stream) {
     // Print times & c-to-c ratio
     // Copied from given sequential code
-    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
-    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
-    double c2cRatio = communicationTime / computationTime;
+    std::cout << "Total Computation Time: " << totals->computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << totals->communicationTime << " seconds" << std::endl;
+    double c2cRatio = totals->communicationTime / totals->computationTime;
     std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+
+    if(renderOptions.stats) {
+        std::cout << "Tiles Outstanding per Worker: " << window << std::endl;
+        std::cout << "Total Worker Idle Time: " << totals->idleTime << " seconds" << std::endl;
+        std::cout << "Tile Bytes Recieved: " << totals->bytesRecieved << std::endl;
+        std::cout << "Work Packets Sent: " << totals->packetsSent << std::endl;
+
+        if(stream != NULL) {
+            std::cout << "Peak Streamed Rows Held: " << stream->peakHeldRows << std::endl;
+            std::cout << "Streaming Encode Time: " << stream->encodeTime << " seconds" << std::endl;
+        }
+    }
+}
+
+// Fills in and saves the preview of a pass, off the thread that runs the
+// queue. The pass's pixels are only read, while the next pass writes
+// different ones. Makes no MPI calls.
+static void savePreview(ConfigData* data, float* pixels, int pass, float* preview, std::string file,
+        std::chrono::steady_clock::time_point renderStart, double* saveTime, double* finishTime) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    fillPreview(data, pixels, pass, preview);
+    savePixels(file, preview, data);
+
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    *saveTime += std::chrono::duration<double>(stop - start).count();
+    *finishTime = std::chrono::duration<double>(stop - renderStart).count();
 }
 
-void incrementWorkPacket(ConfigData* data, int* workPacket) {
-    if(workPacket[0] == -1) {
+void masterDynamicCentralizedQueue(ConfigData* data, float* pixels, ImageStream* stream, std::string file) {
+    QueueTotals totals = { 0.0, 0.0, 0.0, 0, 0, 0 };
+
+    if(!usesProgressive(data)) {
+        runDynamicQueue(data, pixels, stream, MPI_COMM_WORLD, NULL, -1, &totals);
+        printQueueTotals(&totals, renderOptions.dynamicWindow, stream);
         return;
     }
 
-    // Increment in x
-    workPacket[0] += data->dynamicBlockWidth;
-    if(workPacket[0] >= data->width) {
-        // Packet ends up starting out of bounds. Increment in y
-        workPacket[0] = 0;
-        workPacket[1] += data->dynamicBlockHeight;
+    // Every rank renders all of one pass before any of the next, so the
+    // coarse passes come back first. Each is saved as a preview, which
+    // the final image replaces. A preview is saved by its own thread while
+    // the next pass is handed out, so the workers never wait on the PNG.
+    std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    double firstPreviewTime = 0.0;
+    double previewTime = 0.0;
+    double previewFinish = 0.0;
+
+    std::string name = file.substr(0, file.rfind(".png"));
+    float* preview = new float[3 * data->width * data->height];
+
+    std::thread saver;
+    std::string savingFile;
+
+    for(int pass = 0; pass < PROGRESSIVE_PASSES; pass++) {
+        runDynamicQueue(data, pixels, NULL, MPI_COMM_WORLD, NULL, pass, &totals);
+
+        // The preview buffer is reused, so the last save must be done
+        if(saver.joinable()) {
+            saver.join();
+            std::cout << "Preview saved to: " << savingFile << std::endl;
+            if(pass == 1) {
+                firstPreviewTime = previewFinish;
+            }
+        }
+
+        if(pass == PROGRESSIVE_PASSES - 1) {
+            break;
+        }
+
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "_pass%d.png", pass + 1);
+        savingFile = name + suffix;
+        saver = std::thread(savePreview, data, pixels, pass, preview, savingFile, renderStart, &previewTime, &previewFinish);
+    }
+
+    delete[] preview;
+
+    printQueueTotals(&totals, renderOptions.dynamicWindow, NULL);
+    if(renderOptions.stats) {
+        std::cout << "First Preview Time: " << firstPreviewTime << " seconds" << std::endl;
+        std::cout << "Preview Save Time: " << previewTime << " seconds" << std::endl;
+    }
+}
+
+void masterDynamicHierarchical(ConfigData* data, float* pixels, ImageStream* stream) {
+    DynamicHierarchy hierarchy;
+    splitDynamicHierarchy(data, &hierarchy);
+
+    // Rank 0 only talks to the sub-masters, which say how many workers
+    // they each have
+    int subMasters;
+    MPI_Comm_size(hierarchy.leaders, &subMasters);
+    subMasters = std::max(subMasters - 1, 1);
+
+    // Zeroed, since without any sub-masters the gather only fills counts[0]
+    int* counts = new int[subMasters + 1]();
+    int ourWorkers = 0;
+    MPI_Gather(&ourWorkers, 1, MPI_INT, counts, 1, MPI_INT, 0, hierarchy.leaders);
+
+    ChunkSizing chunks;
+    chunks.nodeWorkers = &(counts[1]);
+
+    int tilesAcross = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    int tilesDown = (data->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight;
+    int totalTiles = tilesAcross * tilesDown;
+
+    int mostWorkers = *std::max_element(chunks.nodeWorkers, chunks.nodeWorkers + subMasters);
+    int firstChunk = (totalTiles + (2 * subMasters) - 1) / (2 * subMasters);
+    chunks.maxTiles = std::max(firstChunk, 2 * renderOptions.dynamicWindow * std::max(mostWorkers, 1));
+    chunks.window = std::max(renderOptions.dynamicWindow, 2);
+
+    QueueTotals totals = { 0.0, 0.0, 0.0, 0, 0, 0 };
+    runDynamicQueue(data, pixels, stream, hierarchy.leaders, &chunks, -1, &totals);
+    printQueueTotals(&totals, chunks.window, stream);
+
+    // Messages between the sub-masters and their workers
+    long long nodeMessages = 0;
+    long long noMessages = 0;
+    MPI_Reduce(&noMessages, &nodeMessages, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if(renderOptions.stats) {
+        // A central queue sends every tile, and gets it back, on its own
+        int workers = data->mpi_procs - 1;
+        std::cout << "Sub-Masters: " << subMasters << std::endl;
+        std::cout << "Rank 0 Messages: " << totals.messages << std::endl;
+        std::cout << "Node Level Messages: " << nodeMessages << std::endl;
+        std::cout << "Rank 0 Messages Without Sub-Masters: " << (2 * (long long) totalTiles) + (2 * workers) << std::endl;
+    }
+
+    delete[] counts;
+    freeDynamicHierarchy(&hierarchy);
+}
+
+void masterDistributedWorkStealing(ConfigData* data, float* pixels) {
+    MPI_Status status;
+
+    // Render and steal alongside the slaves, straight into the image
+    double stealingStart = MPI_Wtime();
+
+    StolenTiles results;
+    renderWithWorkStealing(data, pixels, &results);
+
+    double computationTime = results.computationTime;
+
+    // Time spent stealing and waiting rather than rendering
+    double stealingTime = (MPI_Wtime() - stealingStart) - results.computationTime;
+
+    // Start communication timer
+    double communicationStart = MPI_Wtime();
+
+    /*
+     * Each slave sends three messages:
+     *      The indices of the tiles it rendered, as ints
+     *      The pixels of those tiles, one tile after another, as floats
+     *      Its computation time, as a double
+     */
 
-        // Packet ends up starting out of bounds. We're done.
-        if(workPacket[1] >= data->height) {
-            workPacket[0] = -1;
-            workPacket[1] = -1;
+    for(int i = 1; i < data->mpi_procs; i++) {
+        // Take whichever slave is ready first
+        MPI_Probe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
+        int source = status.MPI_SOURCE;
+
+        int tileCount;
+        MPI_Get_count(&status, MPI_INT, &tileCount);
+
+        int* tiles = new int[tileCount];
+        MPI_Recv(tiles, tileCount, MPI_INT, source, 0, MPI_COMM_WORLD, &status);
+
+        // Describe where every row of every tile goes in the image
+        std::vector<int> lengths;
+        std::vector<int> displacements;
+        for(int t = 0; t < tileCount; t++) {
+            int imageX, imageY, tileWidth, tileHeight;
+            getStolenTileBounds(data, tiles[t], &imageX, &imageY, &tileWidth, &tileHeight);
+
+            for(int y = 0; y < tileHeight; y++) {
+                lengths.push_back(3 * tileWidth);
+                displacements.push_back(3 * (((imageY + y) * data->width) + imageX));
+            }
         }
+
+        MPI_Datatype tilesType;
+        MPI_Type_indexed(lengths.size(), lengths.data(), displacements.data(), MPI_FLOAT, &tilesType);
+        MPI_Type_commit(&tilesType);
+
+        MPI_Recv(pixels, 1, tilesType, source, 0, MPI_COMM_WORLD, &status);
+        MPI_Type_free(&tilesType);
+
+        // Include slave computation time
+        computationTime += recieveComputationTime(source);
+
+        delete[] tiles;
+    }
+
+    // Stop communication timer
+    double communicationStop = MPI_Wtime();
+    double communicationTime = stealingTime + (communicationStop - communicationStart);
+
+    // Print times & c-to-c ratio
+    // Copied from given sequential code
+    std::cout << "Total Computation Time: " << computationTime << " seconds" << std::endl;
+    std::cout << "Total Communication Time: " << communicationTime << " seconds" << std::endl;
+    double c2cRatio = communicationTime / computationTime;
+    std::cout << "C-to-C Ratio: " << c2cRatio << std::endl;
+}
+
+void nextWorkPacket(ConfigData* data, TileSequence* sequence, int worker, int tiles, int* workPacket) {
+    // Out of tiles. We're done.
+    if(!takeTiles(data, sequence, worker, tiles, &(workPacket[0]), &(workPacket[1]), &(workPacket[2]), &(workPacket[3]))) {
+        workPacket[0] = -1;
+        workPacket[1] = -1;
+        workPacket[2] = -1;
+        workPacket[3] = -1;
     }
 }
@@ -0,0 +1,64 @@
+// Progressive rendering of dynamic mode, in coarse to fine passes
+
+#include <cstring>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "progressive.h"
+
+bool usesProgressive(ConfigData* data) {
+    return renderOptions.progressive && !renderOptions.streamOutput
+        && (int) data->partitioningMode == PART_MODE_DYNAMIC;
+}
+
+int countPassPixels(int x, int y, int width, int height, int pass) {
+    int count = 0;
+    for(int row = y; row < y + height; row++) {
+        for(int column = x; column < x + width; column++) {
+            if(getPixelPass(column, row) == pass) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void packPassPixels(float* pixels, int x, int y, int width, int height, int pass) {
+    // Pixels only ever move towards the start, so nothing is overwritten
+    // before it is moved
+    int packed = 0;
+    for(int row = 0; row < height; row++) {
+        for(int column = 0; column < width; column++) {
+            if(getPixelPass(x + column, y + row) == pass) {
+                memmove(&(pixels[3 * packed]), &(pixels[3 * ((row * width) + column)]), 3 * sizeof(float));
+                packed++;
+            }
+        }
+    }
+}
+
+void unpackPassPixels(ConfigData* data, float* packed, int x, int y, int width, int height, int pass, float* image) {
+    int next = 0;
+    for(int row = y; row < y + height; row++) {
+        for(int column = x; column < x + width; column++) {
+            if(getPixelPass(column, row) == pass) {
+                memcpy(&(image[3 * ((row * data->width) + column)]), &(packed[3 * next]), 3 * sizeof(float));
+                next++;
+            }
+        }
+    }
+}
+
+void fillPreview(ConfigData* data, float* image, int pass, float* preview) {
+    // Spacing of the pixels rendered so far
+    int step = 1 << (PROGRESSIVE_PASSES - 1 - pass);
+
+    for(int row = 0; row < data->height; row++) {
+        int sourceRow = row - (row % step);
+        for(int column = 0; column < data->width; column++) {
+            int sourceColumn = column - (column % step);
+            memcpy(&(preview[3 * ((row * data->width) + column)]), &(image[3 * ((sourceRow * data->width) + sourceColumn)]), 3 * sizeof(float));
+        }
+    }
+}
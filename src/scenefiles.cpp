@@ -0,0 +1,399 @@
+// Finds, hashes and distributes the files that a scene is read from
+
+#include <mpi.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "scenefiles.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Strips spaces, tabs and line endings from both ends
+static std::string trim(const std::string& text) {
+    const char* space = " \t\r\n";
+    size_t start = text.find_first_not_of(space);
+    if(start == std::string::npos) {
+        return "";
+    }
+
+    return text.substr(start, text.find_last_not_of(space) - start + 1);
+}
+
+// Directory part of a path, including the last slash
+static std::string directoryOf(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    if(slash == std::string::npos) {
+        return "";
+    }
+
+    return path.substr(0, slash + 1);
+}
+
+void listSceneFiles(const char* configFile, std::vector<std::string>* files) {
+    files->clear();
+    files->push_back(configFile);
+
+    std::string config;
+    if(readSceneFile(configFile, &config)) {
+        return;
+    }
+
+    // Models are named relative to where we were run from, like the
+    // library opens them
+    const char* open = "<Path>";
+    const char* close = "</Path>";
+    size_t position = config.find(open);
+    while(position != std::string::npos) {
+        size_t start = position + strlen(open);
+        size_t end = config.find(close, start);
+        if(end == std::string::npos) {
+            break;
+        }
+
+        std::string model = trim(config.substr(start, end - start));
+        files->push_back(model);
+
+        // Material libraries are named relative to the model
+        std::string contents;
+        if(!readSceneFile(model, &contents)) {
+            std::istringstream lines(contents);
+            std::string line;
+            while(std::getline(lines, line)) {
+                std::istringstream words(line);
+                std::string keyword, library;
+                words >> keyword;
+                if(keyword != "mtllib") {
+                    continue;
+                }
+
+                while(words >> library) {
+                    files->push_back(directoryOf(model) + library);
+                }
+            }
+        }
+
+        position = config.find(open, end);
+    }
+}
+
+bool readSceneFile(const std::string& path, std::string* contents) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if(file == NULL) {
+        return true;
+    }
+
+    contents->clear();
+    char buffer[65536];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents->append(buffer, count);
+    }
+
+    bool error = ferror(file) != 0;
+    fclose(file);
+    return error;
+}
+
+// Adds bytes to an FNV-1a hash
+static uint64_t hashBytes(uint64_t hash, const char* bytes, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+uint64_t hashSceneFiles(const std::vector<std::string>& files) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for(size_t i = 0; i < files.size(); i++) {
+        // Names end with their terminator, so moving bytes between a name
+        // and its contents changes the hash
+        hash = hashBytes(hash, files[i].c_str(), files[i].size() + 1);
+
+        std::string contents;
+        if(readSceneFile(files[i], &contents)) {
+            hash = hashBytes(hash, "missing", 7);
+            continue;
+        }
+
+        uint64_t size = contents.size();
+        hash = hashBytes(hash, (const char*) &size, sizeof(size));
+        hash = hashBytes(hash, contents.data(), contents.size());
+    }
+
+    return hash;
+}
+
+// Most bytes sent by one MPI_Bcast, to stay within an int count
+#define SCENE_BCAST_CHUNK (1 << 30)
+
+// Where a scene file is copied to under root. The layout is kept; a
+// leading / or ./ is dropped, and .. is renamed so nothing is written
+// outside root. Material libraries named through .. are no longer where
+// their model expects, so rewriteMaterialLibraries() points models at
+// them again.
+static std::string copyPath(const std::string& root, const std::string& path) {
+    std::string copy = root;
+    std::istringstream parts(path);
+    std::string part;
+    while(std::getline(parts, part, '/')) {
+        if(part.empty() || part == ".") {
+            continue;
+        }
+
+        copy += "/" + (part == ".." ? std::string("_up_") : part);
+    }
+
+    return copy;
+}
+
+// Relative path from a directory to a file, both under the same root
+static std::string relativePath(const std::string& directory, const std::string& file) {
+    std::vector<std::string> from, to;
+    std::string part;
+
+    std::istringstream fromParts(directory);
+    while(std::getline(fromParts, part, '/')) {
+        if(!part.empty()) {
+            from.push_back(part);
+        }
+    }
+
+    std::istringstream toParts(file);
+    while(std::getline(toParts, part, '/')) {
+        if(!part.empty()) {
+            to.push_back(part);
+        }
+    }
+
+    size_t common = 0;
+    while(common < from.size() && common + 1 < to.size() && from[common] == to[common]) {
+        common++;
+    }
+
+    std::string relative;
+    for(size_t i = common; i < from.size(); i++) {
+        relative += "../";
+    }
+    for(size_t i = common; i < to.size(); i++) {
+        relative += (i > common ? "/" : "") + to[i];
+    }
+
+    return relative;
+}
+
+// Points the mtllib lines of a model copied from path at the copies of its
+// material libraries. Every other line is kept as it is.
+static std::string rewriteMaterialLibraries(const std::string& root, const std::string& path, const std::string& contents) {
+    std::string copyDirectory = directoryOf(copyPath(root, path));
+    std::string rewritten;
+
+    size_t start = 0;
+    while(start < contents.size()) {
+        size_t end = contents.find('\n', start);
+        end = (end == std::string::npos) ? contents.size() : end + 1;
+        std::string line = contents.substr(start, end - start);
+        start = end;
+
+        std::istringstream words(line);
+        std::string keyword, library;
+        words >> keyword;
+        if(keyword != "mtllib") {
+            rewritten += line;
+            continue;
+        }
+
+        // Named relative to the model, as listSceneFiles() finds them
+        rewritten += keyword;
+        while(words >> library) {
+            rewritten += " " + relativePath(copyDirectory, copyPath(root, directoryOf(path) + library));
+        }
+
+        size_t ending = line.find_last_not_of("\r\n");
+        rewritten += line.substr(ending == std::string::npos ? 0 : ending + 1);
+    }
+
+    return rewritten;
+}
+
+// Creates every missing directory leading to a file
+static bool makeParentDirectories(const std::string& file) {
+    for(size_t slash = file.find('/', 1); slash != std::string::npos; slash = file.find('/', slash + 1)) {
+        if(mkdir(file.substr(0, slash).c_str(), 0700) != 0 && errno != EEXIST) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Writes a file so that nothing ever sees it half written, even another
+// render copying the same scene to the same node
+static bool writeSceneFile(const std::string& path, const std::string& contents, int rank) {
+    if(makeParentDirectories(path)) {
+        return true;
+    }
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.%d.tmp", (int) getpid(), rank);
+    std::string temporary = path + suffix;
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if(file == NULL) {
+        return true;
+    }
+
+    bool error = fwrite(contents.data(), 1, contents.size(), file) != contents.size();
+    error = (fclose(file) != 0) || error;
+
+    if(error || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return true;
+    }
+
+    return false;
+}
+
+// Appends a 64-bit length to a buffer
+static void packLength(std::string* buffer, long long length) {
+    buffer->append((const char*) &length, sizeof(length));
+}
+
+static long long unpackLength(const std::string& buffer, size_t* position) {
+    long long length;
+    memcpy(&length, &(buffer[*position]), sizeof(length));
+    *position += sizeof(length);
+    return length;
+}
+
+bool shareSceneFiles(const char* configFile, const char* directory, std::string* localConfigFile, long long* bytes) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    /*
+     * Rank 0 packs every file as:
+     *      path length, path, contents length (-1 if missing), contents
+     * and broadcasts them to the lowest rank on each node, which writes
+     * them out.
+     */
+
+    std::string buffer;
+    if(rank == 0) {
+        std::vector<std::string> files;
+        listSceneFiles(configFile, &files);
+
+        for(size_t i = 0; i < files.size(); i++) {
+            std::string contents;
+            bool missing = readSceneFile(files[i], &contents);
+
+            packLength(&buffer, files[i].size());
+            buffer += files[i];
+            packLength(&buffer, missing ? -1 : (long long) contents.size());
+            buffer += contents;
+        }
+    }
+
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    int nodeRank;
+    MPI_Comm_rank(node, &nodeRank);
+
+    // Rank 0 is always the lowest rank of its node
+    MPI_Comm leaders;
+    MPI_Comm_split(MPI_COMM_WORLD, nodeRank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+
+    long long size = buffer.size();
+    MPI_Bcast(&size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    *bytes = size;
+
+    // Without a configuration file there is nothing to copy, and the
+    // library reports it missing at its original path
+    std::string config = configFile;
+
+    int failed = 0;
+    if(leaders != MPI_COMM_NULL) {
+        buffer.resize(size);
+        for(long long sent = 0; sent < size; sent += SCENE_BCAST_CHUNK) {
+            int count = (int) std::min<long long>(SCENE_BCAST_CHUNK, size - sent);
+            MPI_Bcast(&(buffer[sent]), count, MPI_BYTE, 0, leaders);
+        }
+        MPI_Comm_free(&leaders);
+
+        // Renders of other versions of the scene may be using the same
+        // directory, so every version gets its own
+        char hash[32];
+        snprintf(hash, sizeof(hash), "/scene_%016llx", (unsigned long long) hashBytes(FNV_OFFSET_BASIS, buffer.data(), buffer.size()));
+        std::string root = std::string(directory) + hash;
+
+        size_t position = 0;
+        bool first = true;
+        while(position < buffer.size() && !failed) {
+            long long pathLength = unpackLength(buffer, &position);
+            std::string path = buffer.substr(position, pathLength);
+            position += pathLength;
+
+            long long contentsLength = unpackLength(buffer, &position);
+            if(contentsLength < 0) {
+                // The library reports missing models itself
+                first = false;
+                continue;
+            }
+
+            std::string contents = buffer.substr(position, contentsLength);
+            position += contentsLength;
+
+            // Point the models of the configuration file at their copies
+            if(first) {
+                std::string rewritten;
+                size_t start = 0;
+                size_t open = contents.find("<Path>");
+                while(open != std::string::npos) {
+                    size_t pathStart = open + strlen("<Path>");
+                    size_t close = contents.find("</Path>", pathStart);
+                    if(close == std::string::npos) {
+                        break;
+                    }
+
+                    rewritten += contents.substr(start, pathStart - start);
+                    rewritten += copyPath(root, trim(contents.substr(pathStart, close - pathStart)));
+                    start = close;
+                    open = contents.find("<Path>", close);
+                }
+                rewritten += contents.substr(start);
+                contents = rewritten;
+                config = copyPath(root, path);
+            } else {
+                contents = rewriteMaterialLibraries(root, path, contents);
+            }
+
+            if(writeSceneFile(copyPath(root, path), contents, rank)) {
+                std::cerr << "Could not copy " << path << " to " << copyPath(root, path) << std::endl;
+                failed = 1;
+            }
+            first = false;
+        }
+    }
+
+    // Once every node has its copy, everyone loads from the one on their node
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+
+    int configLength = config.size();
+    MPI_Bcast(&configLength, 1, MPI_INT, 0, node);
+    config.resize(configLength);
+    MPI_Bcast(&(config[0]), configLength, MPI_CHAR, 0, node);
+    MPI_Comm_free(&node);
+
+    *localConfigFile = config;
+    return failed != 0;
+}
@@ -0,0 +1,240 @@
+// Static modes rendering into an image shared by the ranks of each node,
+// so only one part of the image per node is sent to the master
+
+#include <mpi.h>
+#include <algorithm>
+#include <vector>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "sharedimage.h"
+
+bool usesSharedImage(ConfigData* data) {
+    if(!renderOptions.sharedImage) {
+        return false;
+    }
+
+    switch((int) data->partitioningMode) {
+        case PART_MODE_STATIC_STRIPS_HORIZONTAL:
+        case PART_MODE_STATIC_STRIPS_VERTICAL:
+        case PART_MODE_STATIC_CYCLES_HORIZONTAL:
+        case PART_MODE_STATIC_CYCLES_VERTICAL:
+        case PART_MODE_STATIC_BLOCKS:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Gets the parts of the image a rank renders in the current static mode,
+ * the same ones the master and slave functions of the mode use
+ *
+ * @param data Scene information
+ * @param rank Rank to get the parts of
+ * @param rects Added to with each part as x y width height
+ */
+static void getRankRects(ConfigData* data, int rank, std::vector<int>* rects) {
+    int procs = data->mpi_procs;
+    bool last = (rank == procs - 1);
+
+    switch((int) data->partitioningMode) {
+        case PART_MODE_STATIC_STRIPS_HORIZONTAL: {
+            // Last rank has the remainder as well
+            int height = data->height / procs;
+            int rectHeight = height + (last ? data->height % procs : 0);
+            int rect[4] = { 0, height * rank, data->width, rectHeight };
+            rects->insert(rects->end(), rect, rect + 4);
+            break;
+        }
+
+        case PART_MODE_STATIC_STRIPS_VERTICAL: {
+            int width = data->width / procs;
+            int rectWidth = width + (last ? data->width % procs : 0);
+            int rect[4] = { width * rank, 0, rectWidth, data->height };
+            rects->insert(rects->end(), rect, rect + 4);
+            break;
+        }
+
+        case PART_MODE_STATIC_CYCLES_HORIZONTAL:
+            for(int y = rank * data->cycleSize; y < data->height; y += data->cycleSize * procs) {
+                int rect[4] = { 0, y, data->width, std::min(data->cycleSize, data->height - y) };
+                rects->insert(rects->end(), rect, rect + 4);
+            }
+            break;
+
+        case PART_MODE_STATIC_CYCLES_VERTICAL:
+            for(int x = rank * data->cycleSize; x < data->width; x += data->cycleSize * procs) {
+                int rect[4] = { x, 0, std::min(data->cycleSize, data->width - x), data->height };
+                rects->insert(rects->end(), rect, rect + 4);
+            }
+            break;
+
+        case PART_MODE_STATIC_BLOCKS: {
+            int rect[4];
+            getBlockBounds(data, rank, &rect[0], &rect[1], &rect[2], &rect[3]);
+            rects->insert(rects->end(), rect, rect + 4);
+            break;
+        }
+    }
+}
+
+/*
+ * Gets the parts of the image the ranks of a node render, in rank order
+ *
+ * @param data Scene information
+ * @param image Image from openSharedImage()
+ * @param leader Lowest rank of the node
+ * @param rects Added to with each part as x y width height
+ */
+static void getNodeRects(ConfigData* data, SharedImage* image, int leader, std::vector<int>* rects) {
+    for(int rank = 0; rank < data->mpi_procs; rank++) {
+        if(image->leaders[rank] == leader) {
+            getRankRects(data, rank, rects);
+        }
+    }
+}
+
+// Number of channels in some parts of the image
+static int countRectChannels(std::vector<int>* rects) {
+    int channels = 0;
+    for(size_t i = 0; i < rects->size(); i += 4) {
+        channels += 3 * (*rects)[i + 2] * (*rects)[i + 3];
+    }
+
+    return channels;
+}
+
+void openSharedImage(ConfigData* data, SharedImage* image) {
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, data->mpi_rank, MPI_INFO_NULL, &(image->node));
+
+    int nodeRank;
+    MPI_Comm_rank(image->node, &nodeRank);
+
+    int leader = data->mpi_rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, image->node);
+
+    image->leaders.resize(data->mpi_procs);
+    MPI_Allgather(&leader, 1, MPI_INT, image->leaders.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    // The master's node holds the whole image, to recieve the other nodes'
+    // parts into and save. Every other node only holds its own parts.
+    image->packed = (leader != 0);
+    MPI_Aint size = 0;
+    if(nodeRank == 0) {
+        int channels = 3 * data->width * data->height;
+        if(image->packed) {
+            std::vector<int> rects;
+            getNodeRects(data, image, leader, &rects);
+            channels = countRectChannels(&rects);
+        }
+
+        size = (MPI_Aint) (channels * sizeof(float));
+    }
+
+    // The lowest rank holds the memory, the others map it in
+    float* ours;
+    MPI_Win_allocate_shared(size, sizeof(float), MPI_INFO_NULL, image->node, &ours, &(image->window));
+
+    MPI_Aint sharedSize;
+    int unit;
+    MPI_Win_shared_query(image->window, 0, &sharedSize, &unit, &(image->pixels));
+
+    // Stores and loads are ordered by syncSharedImage() within one long
+    // passive epoch
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, image->window);
+}
+
+double renderSharedImage(ConfigData* data, SharedImage* image) {
+    double start = MPI_Wtime();
+
+    std::vector<int> rects;
+    getRankRects(data, data->mpi_rank, &rects);
+
+    // Packed parts follow those of the lower ranks of the node
+    int offset = 0;
+    if(image->packed) {
+        std::vector<int> before;
+        for(int rank = image->leaders[data->mpi_rank]; rank < data->mpi_rank; rank++) {
+            if(image->leaders[rank] == image->leaders[data->mpi_rank]) {
+                getRankRects(data, rank, &before);
+            }
+        }
+        offset = countRectChannels(&before);
+    }
+
+    for(size_t i = 0; i < rects.size(); i += 4) {
+        RenderRegion region;
+        region.xInImage = rects[i + 0];
+        region.yInImage = rects[i + 1];
+        region.width = rects[i + 2];
+        region.height = rects[i + 3];
+
+        if(image->packed) {
+            // One part after another, each at its own width
+            region.xInPixels = 0;
+            region.yInPixels = 0;
+            region.pixelsWidth = region.width;
+            region.pixelsHeight = region.height;
+            region.pixels = &(image->pixels[offset]);
+            offset += 3 * region.width * region.height;
+        } else {
+            region.xInPixels = region.xInImage;
+            region.yInPixels = region.yInImage;
+            region.pixelsWidth = data->width;
+            region.pixelsHeight = data->height;
+            region.pixels = image->pixels;
+        }
+
+        renderRegion(data, &region);
+    }
+
+    return MPI_Wtime() - start;
+}
+
+void syncSharedImage(SharedImage* image) {
+    MPI_Win_sync(image->window);
+    MPI_Barrier(image->node);
+    MPI_Win_sync(image->window);
+}
+
+MPI_Datatype createNodeImageType(ConfigData* data, SharedImage* image, int leader) {
+    std::vector<int> rects;
+    getNodeRects(data, image, leader, &rects);
+
+    // Packed parts are already one after another, in the same order
+    if(image->packed) {
+        MPI_Datatype packedType;
+        MPI_Type_contiguous(countRectChannels(&rects), MPI_FLOAT, &packedType);
+        MPI_Type_commit(&packedType);
+        return packedType;
+    }
+
+    // One block of rows per part, placed where it is in the image
+    int count = rects.size() / 4;
+    std::vector<int> lengths(count, 1);
+    std::vector<MPI_Aint> displacements(count);
+    std::vector<MPI_Datatype> types(count);
+    for(int i = 0; i < count; i++) {
+        int* rect = &(rects[4 * i]);
+        MPI_Type_vector(rect[3], 3 * rect[2], 3 * data->width, MPI_FLOAT, &(types[i]));
+        displacements[i] = (MPI_Aint) (3 * (rect[0] + (rect[1] * data->width)) * sizeof(float));
+    }
+
+    MPI_Datatype nodeType;
+    MPI_Type_create_struct(count, lengths.data(), displacements.data(), types.data(), &nodeType);
+    MPI_Type_commit(&nodeType);
+
+    for(int i = 0; i < count; i++) {
+        MPI_Type_free(&(types[i]));
+    }
+
+    return nodeType;
+}
+
+void closeSharedImage(SharedImage* image) {
+    MPI_Win_unlock_all(image->window);
+    MPI_Win_free(&(image->window));
+    MPI_Comm_free(&(image->node));
+}
@@ -2,23 +2,54 @@
 
 #include <iostream>
 #include <mpi.h>
+#include <cstring>
 #include <math.h>
 
 #include "RayTrace.h"
 #include "slave.h"
 #include "common.h"
+#include "workstealing.h"
+#include "costmodel.h"
+#include "wireformat.h"
+#include "tileorder.h"
+#include "hierarchy.h"
+#include "sharedimage.h"
+#include "progressive.h"
+#include "tonemap.h"
+
+// Sends the results of the static modes. The computation time goes first
+// so the master knows we are done rendering before the pixels arrive.
+// Tone mapped pixels are sent as the 8 bits they are saved as.
+static void sendStaticResults(ConfigData* data, float* pixels, int count, double comp_time) {
+    MPI_Send(&comp_time, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+
+    if(usesToneMapping(data)) {
+        unsigned char* quantized = new unsigned char[count];
+        toneMapPixels(pixels, count, quantized);
+        MPI_Send(quantized, count, MPI_UNSIGNED_CHAR, 0, 0, MPI_COMM_WORLD);
+        delete[] quantized;
+        return;
+    }
+
+    MPI_Send(pixels, count, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+}
 
 void slaveMain(ConfigData* data)
 {
     //Depending on the partitioning scheme, different things will happen.
     //You should have a different function for each of the required 
     //schemes that returns some values that you need to handle.
-    switch (data->partitioningMode)
+    //Compared as an int, since common.h adds modes that PartType lacks.
+    switch ((int) data->partitioningMode)
     {
         case PART_MODE_NONE:
             //The slave will do nothing since this means sequential operation.
             break;
         
+        case PART_MODE_STATIC_STRIPS_HORIZONTAL:
+            slaveStaticContinuousRows(data);
+            break;
+
         case PART_MODE_STATIC_STRIPS_VERTICAL:
             slaveStaticContinuousColumns(data);
             break;
@@ -26,15 +57,38 @@ void slaveMain(ConfigData* data)
         case PART_MODE_STATIC_CYCLES_HORIZONTAL:
             slaveStaticCyclicalRows(data);
             break;
+
+        case PART_MODE_STATIC_CYCLES_VERTICAL:
+            slaveStaticCyclicalColumns(data);
+            break;
         
         case PART_MODE_DYNAMIC:
-            slaveDynamicCentralizedQueue(data);
+            if(usesProgressive(data)) {
+                // The master runs the queue once for each pass
+                for(int pass = 0; pass < PROGRESSIVE_PASSES; pass++) {
+                    slaveDynamicCentralizedQueue(data, MPI_COMM_WORLD, pass);
+                }
+            } else {
+                slaveDynamicCentralizedQueue(data, MPI_COMM_WORLD, -1);
+            }
+            break;
+
+        case PART_MODE_DYNAMIC_HIERARCHICAL:
+            slaveDynamicHierarchical(data);
             break;
 
         case PART_MODE_STATIC_BLOCKS:
             slaveStaticSquareBlocks(data);
             break;
 
+        case PART_MODE_STATIC_COST_BLOCKS:
+            slaveStaticCostBlocks(data);
+            break;
+
+        case PART_MODE_WORK_STEALING:
+            slaveDistributedWorkStealing(data);
+            break;
+
         default:
             std::cout << "This mode (" << data->partitioningMode;
             std::cout << ") is not currently implemented." << std::endl;
@@ -43,6 +97,11 @@ void slaveMain(ConfigData* data)
 }
 
 void slaveStaticContinuousColumns(ConfigData* data) {
+    if(usesSharedImage(data)) {
+        slaveStaticSharedImage(data);
+        return;
+    }
+
     double comp_start, comp_stop, comp_time;
     comp_start = MPI_Wtime();
 
@@ -70,8 +129,7 @@ void slaveStaticContinuousColumns(ConfigData* data) {
     region.pixelsWidth = region.width;
     region.pixelsHeight = region.height;
 
-    // Pixels includes 1 extra entry for computation time
-    int pixelsSize = (3 * region.pixelsWidth * region.pixelsHeight) + 1;
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
     region.pixels = new float[pixelsSize];
 
     // Render our region
@@ -81,44 +139,74 @@ void slaveStaticContinuousColumns(ConfigData* data) {
     comp_stop = MPI_Wtime();
     comp_time = comp_stop - comp_start;
 
-    region.pixels[pixelsSize - 1] = (float) comp_time;
-    MPI_Send(region.pixels, pixelsSize, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+    sendStaticResults(data, region.pixels, pixelsSize, comp_time);
     delete[] region.pixels;
 }
 
-void slaveStaticSquareBlocks(ConfigData* data) {
+void slaveStaticContinuousRows(ConfigData* data) {
+    if(usesSharedImage(data)) {
+        slaveStaticSharedImage(data);
+        return;
+    }
+
     double comp_start, comp_stop, comp_time;
     comp_start = MPI_Wtime();
 
     // Describe our region
-    int subregionWidth, subregionHeight, ourWidth, ourHeight;
-    subregionWidth = data->width / ((int)sqrt(data->mpi_procs));
-    subregionHeight = data->height / ((int)sqrt(data->mpi_procs));
+    int subregionHeight, ourHeight;
+    subregionHeight = data->height / data->mpi_procs;
 
-    // Last slave handles remainder, if work is evenly distributed this
-    // overlaps with other slaves' communication
+    // Last slave handles remainder
     if(data->mpi_rank == data->mpi_procs - 1) {
         // we're last
-        ourWidth = subregionWidth + (data->width % ((int)sqrt(data->mpi_procs)));
-        ourHeight = subregionHeight + (data->height % ((int)sqrt(data->mpi_procs)));
+        ourHeight = subregionHeight + (data->height % data->mpi_procs);
     } else {
         // we're not last
-        ourWidth = subregionWidth;
         ourHeight = subregionHeight;
     }
 
     RenderRegion region;
-    region.xInImage = subregionWidth * (data->mpi_rank % (int)sqrt(data->mpi_procs));
-    region.yInImage = subregionHeight * (data->mpi_rank / (int)sqrt(data->mpi_procs));
+    region.xInImage = 0;
+    region.yInImage = subregionHeight * data->mpi_rank;
     region.xInPixels = 0;
     region.yInPixels = 0;
-    region.width = ourWidth;
+    region.width = data->width;
     region.height = ourHeight;
     region.pixelsWidth = region.width;
     region.pixelsHeight = region.height;
 
-    // Pixels includes 1 extra entry for computation time
-    int pixelsSize = (3 * region.pixelsWidth * region.pixelsHeight) + 1;
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
+    region.pixels = new float[pixelsSize];
+
+    // Render our region
+    renderRegion(data, &region);
+
+    // Send our results, whole rows are already laid out as in the image
+    comp_stop = MPI_Wtime();
+    comp_time = comp_stop - comp_start;
+
+    sendStaticResults(data, region.pixels, pixelsSize, comp_time);
+    delete[] region.pixels;
+}
+
+void slaveStaticSquareBlocks(ConfigData* data) {
+    if(usesSharedImage(data)) {
+        slaveStaticSharedImage(data);
+        return;
+    }
+
+    double comp_start, comp_stop, comp_time;
+    comp_start = MPI_Wtime();
+
+    // Describe our region, our place in the grid of processes
+    RenderRegion region;
+    getBlockBounds(data, data->mpi_rank, &region.xInImage, &region.yInImage, &region.width, &region.height);
+    region.xInPixels = 0;
+    region.yInPixels = 0;
+    region.pixelsWidth = region.width;
+    region.pixelsHeight = region.height;
+
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
     region.pixels = new float[pixelsSize];
 
     // Render our region
@@ -128,12 +216,16 @@ void slaveStaticSquareBlocks(ConfigData* data) {
     comp_stop = MPI_Wtime();
     comp_time = comp_stop - comp_start;
 
-    region.pixels[pixelsSize - 1] = (float) comp_time;
-    MPI_Send(region.pixels, pixelsSize, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+    sendStaticResults(data, region.pixels, pixelsSize, comp_time);
     delete[] region.pixels;
 }
 
 void slaveStaticCyclicalRows(ConfigData* data) {
+    if(usesSharedImage(data)) {
+        slaveStaticSharedImage(data);
+        return;
+    }
+
     double comp_start, comp_stop, comp_time;
     comp_start = MPI_Wtime();
 
@@ -151,13 +243,13 @@ void slaveStaticCyclicalRows(ConfigData* data) {
     region.pixelsWidth = data->width;
     region.pixelsHeight = maxSubregions * data->cycleSize;
 
-    // Pixels includes 1 extra entry for computation time
-    int pixelsSize = (3 * region.pixelsWidth * region.pixelsHeight) + 1;
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
     region.pixels = new float[pixelsSize];
 
     // Render our subregions
     region.yInImage = (data->mpi_rank * data->cycleSize);
     region.yInPixels = 0;
+    int renderedRows = 0;
 
     while(region.yInImage < data->height) {
         // Make sure we don't overrun
@@ -168,22 +260,136 @@ void slaveStaticCyclicalRows(ConfigData* data) {
         // Render subregion
         renderRegion(data, &region);
 
+        renderedRows += region.height;
         region.yInImage += data->cycleSize * data->mpi_procs;
         region.yInPixels += data->cycleSize;
     }
 
-    // Send our results
+    // Send our results, only the rows we rendered
+    comp_stop = MPI_Wtime();
+    comp_time = comp_stop - comp_start;
+
+    sendStaticResults(data, region.pixels, 3 * data->width * renderedRows, comp_time);
+    delete[] region.pixels;
+}
+
+void slaveStaticCyclicalColumns(ConfigData* data) {
+    if(usesSharedImage(data)) {
+        slaveStaticSharedImage(data);
+        return;
+    }
+
+    double comp_start, comp_stop, comp_time;
+    comp_start = MPI_Wtime();
+
+    // Describe our region
+    RenderRegion region;
+    region.yInImage = 0;
+    region.yInPixels = 0;
+    region.width = data->cycleSize;
+    region.height = data->height;
+
+    // Our columns, packed next to each other in every row
+    int ourColumns = 0;
+    for(int x = data->mpi_rank * data->cycleSize; x < data->width; x += data->cycleSize * data->mpi_procs) {
+        ourColumns += (x + data->cycleSize >= data->width) ? data->width - x : data->cycleSize;
+    }
+
+    region.pixelsWidth = ourColumns;
+    region.pixelsHeight = data->height;
+
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
+    region.pixels = new float[pixelsSize];
+
+    // Render our subregions
+    region.xInImage = (data->mpi_rank * data->cycleSize);
+    region.xInPixels = 0;
+
+    while(region.xInImage < data->width) {
+        // Make sure we don't overrun
+        if(region.xInImage + data->cycleSize >= data->width) {
+            region.width = data->width - region.xInImage;
+        }
+
+        // Render subregion
+        renderRegion(data, &region);
+
+        region.xInImage += data->cycleSize * data->mpi_procs;
+        region.xInPixels += data->cycleSize;
+    }
+
+    // Send our results, the master spreads the columns back out
     comp_stop = MPI_Wtime();
     comp_time = comp_stop - comp_start;
 
-    region.pixels[pixelsSize - 1] = (float) comp_time;
-    MPI_Send(region.pixels, pixelsSize, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+    sendStaticResults(data, region.pixels, pixelsSize, comp_time);
     delete[] region.pixels;
 }
 
-void slaveDynamicCentralizedQueue(ConfigData* data) {
+void slaveStaticSharedImage(ConfigData* data) {
+    SharedImage image;
+    openSharedImage(data, &image);
+
+    // Render our part straight into our node's image
+    double comp_time = renderSharedImage(data, &image);
+    syncSharedImage(&image);
+
+    // The master already has its own node's image, the lowest rank of
+    // every other node sends the whole node's part at once
+    if(image.leaders[data->mpi_rank] == data->mpi_rank) {
+        MPI_Datatype nodeType = createNodeImageType(data, &image, data->mpi_rank);
+        MPI_Send(image.pixels, 1, nodeType, 0, 0, MPI_COMM_WORLD);
+        MPI_Type_free(&nodeType);
+    }
+
+    MPI_Reduce(&comp_time, NULL, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    closeSharedImage(&image);
+}
+
+void slaveStaticCostBlocks(ConfigData* data) {
+    double comp_start, comp_stop, comp_time;
+
+    // Help estimate the cost of the image, then find our block
+    CostMap map;
+    double samplingTime = buildCostMap(data, &map);
+
+    int* rects = new int[4 * data->mpi_procs];
+    partitionByCost(data, &map, rects);
+    freeCostMap(&map);
+
+    comp_start = MPI_Wtime();
+
+    // Describe our region
+    RenderRegion region;
+    region.xInImage = rects[(4 * data->mpi_rank) + 0];
+    region.yInImage = rects[(4 * data->mpi_rank) + 1];
+    region.xInPixels = 0;
+    region.yInPixels = 0;
+    region.width = rects[(4 * data->mpi_rank) + 2];
+    region.height = rects[(4 * data->mpi_rank) + 3];
+    region.pixelsWidth = region.width;
+    region.pixelsHeight = region.height;
+
+    delete[] rects;
+
+    int pixelsSize = 3 * region.pixelsWidth * region.pixelsHeight;
+    region.pixels = new float[pixelsSize];
+
+    // Render our region
+    renderRegion(data, &region);
+
+    // Send our results
+    comp_stop = MPI_Wtime();
+    comp_time = samplingTime + (comp_stop - comp_start);
+
+    sendStaticResults(data, region.pixels, pixelsSize, comp_time);
+    delete[] region.pixels;
+}
+
+void slaveDynamicCentralizedQueue(ConfigData* data, MPI_Comm comm, int pass) {
     double comp_start, comp_stop, comp_time;
     MPI_Status status;
+    int window = renderOptions.dynamicWindow;
 
     // Describe the region of a tile
     RenderRegion region;
@@ -192,61 +398,205 @@ void slaveDynamicCentralizedQueue(ConfigData* data) {
     region.pixelsWidth = data->dynamicBlockWidth;
     region.pixelsHeight = data->dynamicBlockHeight;
 
-    // Pixels includes 3 extra entries for x, y, computation time
-    int pixelsSize = (3 * region.pixelsWidth * region.pixelsHeight) + 3;
-    region.pixels = new float[pixelsSize];
+    // Two buffers, so one can be sent while the other is rendered into,
+    // each big enough for the largest work packet
+    int pixelsSize = 3 * getMaxPacketTiles(data) * region.pixelsWidth * region.pixelsHeight;
+    float* resultsBuffers[2];
+    resultsBuffers[0] = new float[pixelsSize];
+    resultsBuffers[1] = new float[pixelsSize];
+    MPI_Request sendRequests[2] = { MPI_REQUEST_NULL, MPI_REQUEST_NULL };
+    int currentBuffer = 0;
+
+    // Header and pixels in the wire format for each buffer. Float pixels
+    // are sent as rendered.
+    WireFormat format = renderOptions.wireFormat;
+    MPI_Datatype headerType = createTileHeaderType();
+    TileHeader headers[2];
+    void* wireBuffers[2];
+    for(int i = 0; i < 2; i++) {
+        if(format == WIRE_FORMAT_FLOAT) {
+            wireBuffers[i] = resultsBuffers[i];
+        } else {
+            wireBuffers[i] = new unsigned char[pixelsSize * wireChannelSize(format)];
+        }
+    }
+
+    // Work packets that have arrived but have not been rendered yet
+    int* queuedWork = new int[4 * window];
+    int queueHead = 0;
+    int queueCount = 0;
+
+    int* workPacket = new int[4];
+    MPI_Request workRequest;
+    bool finished = false;
 
-    int* workPacket = new int[2];
+    // Time spent with nothing to render since the last tile was sent
+    double idleTime = 0.0;
 
     /*
-     * 1.   Recieve initial work
-     * 2.   Render tile
-     * 3.   Send rendered data to master as (array, x, y, time) floats
-     * 4.   Recieve more work as (x y) ints
-     * 5.   If -1 -1 not recieved, continue from 2.
+     * 1.   Recieve work as (x y width height) ints, up to the window size
+     *      at a time
+     * 2.   Render the oldest queued tile
+     * 3.   Send a header with the tile's region and timings, and the
+     *      rendered pixels in the wire format, to master as one message
+     *      without waiting for it to arrive
+     * 4.   If -1 -1 -1 -1 not recieved, continue from 1.
+     * 5.   Send a last header without pixels, with the idle time since
+     *      the last tile
      */
 
+    MPI_Irecv(workPacket, 4, MPI_INT, 0, 0, comm, &workRequest);
+
     while(true) {
-        // Recieve work
-        MPI_Recv(workPacket, 2, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
+        // Queue up whatever work has arrived, waiting only if we have none
+        while(!finished) {
+            int flag;
+            if(queueCount == 0) {
+                double idleStart = MPI_Wtime();
+                MPI_Wait(&workRequest, &status);
+                idleTime += MPI_Wtime() - idleStart;
+                flag = 1;
+            } else {
+                MPI_Test(&workRequest, &flag, &status);
+            }
+
+            if(!flag) {
+                break;
+            }
+
+            // Are we done
+            if(workPacket[0] == -1) {
+                finished = true;
+                break;
+            }
+
+            int tail = (queueHead + queueCount) % window;
+            memcpy(&(queuedWork[4 * tail]), workPacket, 4 * sizeof(int));
+            queueCount++;
+
+            MPI_Irecv(workPacket, 4, MPI_INT, 0, 0, comm, &workRequest);
+        }
 
-        // Are we done
-        if(workPacket[0] == -1) {
+        if(queueCount == 0) {
             break;
         }
 
         // Not done. Render a tile
         comp_start = MPI_Wtime();
-        region.xInImage = workPacket[0];
-        region.yInImage = workPacket[1];
-
-        // Don't render out of bounds
-        if(region.xInImage + data->dynamicBlockWidth >= data->width) {
-            region.width = data->width - region.xInImage;
+        region.xInImage = queuedWork[4 * queueHead];
+        region.yInImage = queuedWork[(4 * queueHead) + 1];
+        region.width = queuedWork[(4 * queueHead) + 2];
+        region.height = queuedWork[(4 * queueHead) + 3];
+        queueHead = (queueHead + 1) % window;
+        queueCount--;
+
+        // Make sure the last send from this buffer is finished
+        double idleStart = MPI_Wtime();
+        MPI_Wait(&(sendRequests[currentBuffer]), &status);
+        idleTime += MPI_Wtime() - idleStart;
+
+        // Render, packed to the width of the tile
+        region.pixelsWidth = region.width;
+        region.pixelsHeight = region.height;
+        region.pixels = resultsBuffers[currentBuffer];
+        int channels = 3 * region.width * region.height;
+        if(pass >= 0) {
+            // Only the new pixels of the pass are sent, packed together
+            renderRegionPass(data, &region, pass);
+            packPassPixels(region.pixels, region.xInImage, region.yInImage, region.width, region.height, pass);
+            channels = 3 * countPassPixels(region.xInImage, region.yInImage, region.width, region.height, pass);
         } else {
-            region.width = data->dynamicBlockWidth;
+            renderRegion(data, &region);
         }
 
-        if(region.yInImage + data->dynamicBlockHeight >= data->height) {
-            region.height = data->height - region.yInImage;
-        } else {
-            region.height = data->dynamicBlockHeight;
-        }
-
-        // Render
-        renderRegion(data, &region);
-
         // Report results
         comp_stop = MPI_Wtime();
         comp_time = comp_stop - comp_start;
 
-        region.pixels[pixelsSize - 3] = (float) region.xInImage;
-        region.pixels[pixelsSize - 2] = (float) region.yInImage;
-        region.pixels[pixelsSize - 1] = (float) comp_time;
-        MPI_Send(region.pixels, pixelsSize, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+        TileHeader* header = &(headers[currentBuffer]);
+        header->x = region.xInImage;
+        header->y = region.yInImage;
+        header->width = region.width;
+        header->height = region.height;
+        header->computationTime = comp_time;
+        header->idleTime = idleTime;
+        idleTime = 0.0;
+
+        if(format != WIRE_FORMAT_FLOAT) {
+            encodePixels(format, region.pixels, channels, wireBuffers[currentBuffer]);
+        }
+
+        MPI_Datatype pixelsType;
+        MPI_Type_contiguous(channels, wireChannelType(format), &pixelsType);
+        MPI_Type_commit(&pixelsType);
+
+        MPI_Datatype messageType = createTileMessageType(headerType, header, pixelsType, wireBuffers[currentBuffer]);
+        MPI_Isend(MPI_BOTTOM, 1, messageType, 0, 0, comm, &(sendRequests[currentBuffer]));
+
+        // Freed once the send is done
+        MPI_Type_free(&messageType);
+        MPI_Type_free(&pixelsType);
+
+        currentBuffer = 1 - currentBuffer;
     }
 
+    // Let the master know how long we were idle after the last tile
+    MPI_Waitall(2, sendRequests, MPI_STATUSES_IGNORE);
+
+    TileHeader lastHeader;
+    lastHeader.x = 0;
+    lastHeader.y = 0;
+    lastHeader.width = 0;
+    lastHeader.height = 0;
+    lastHeader.computationTime = 0.0;
+    lastHeader.idleTime = idleTime;
+    MPI_Send(&lastHeader, 1, headerType, 0, 0, comm);
+
     // clean up
-    delete[] region.pixels;
+    MPI_Type_free(&headerType);
+    for(int i = 0; i < 2; i++) {
+        if(format != WIRE_FORMAT_FLOAT) {
+            delete[] (unsigned char*) wireBuffers[i];
+        }
+        delete[] resultsBuffers[i];
+    }
+    delete[] queuedWork;
     delete[] workPacket;
 }
+
+void slaveDistributedWorkStealing(ConfigData* data) {
+    StolenTiles results;
+    renderWithWorkStealing(data, NULL, &results);
+
+    // Send the indices of our tiles, their pixels, then our time
+    int tileCount = results.tiles.size();
+    MPI_Send(results.tiles.data(), tileCount, MPI_INT, 0, 0, MPI_COMM_WORLD);
+    MPI_Send(results.pixels.data(), results.pixels.size(), MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+    MPI_Send(&(results.computationTime), 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+}
+
+void slaveDynamicHierarchical(ConfigData* data) {
+    DynamicHierarchy hierarchy;
+    splitDynamicHierarchy(data, &hierarchy);
+
+    int groupRank, groupSize;
+    MPI_Comm_rank(hierarchy.group, &groupRank);
+    MPI_Comm_size(hierarchy.group, &groupSize);
+
+    // Messages between us and our workers, if we are a sub-master
+    long long messages = 0;
+
+    if(groupRank == 0) {
+        // Let rank 0 know how many workers we have to keep busy
+        int workers = groupSize - 1;
+        MPI_Gather(&workers, 1, MPI_INT, NULL, 1, MPI_INT, 0, hierarchy.leaders);
+
+        messages = runSubMaster(data, &hierarchy);
+    } else {
+        slaveDynamicCentralizedQueue(data, hierarchy.group, -1);
+    }
+
+    MPI_Reduce(&messages, NULL, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    freeDynamicHierarchy(&hierarchy);
+}
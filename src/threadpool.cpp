@@ -0,0 +1,164 @@
+// Work-stealing thread pool used to render tiles within a process
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+#include "threadpool.h"
+
+// Queue of tiles owned by one thread
+typedef struct {
+    std::mutex lock;
+    std::deque<int> tiles;
+} TileQueue;
+
+static int poolSize = 1;
+static TileQueue* queues = NULL;
+static std::vector<std::thread> workers;
+
+// Job state, guarded by poolLock
+static std::mutex poolLock;
+static std::condition_variable jobStarted;
+static std::condition_variable jobFinished;
+static unsigned long jobGeneration = 0;
+static int busyWorkers = 0;
+static bool stopping = false;
+static TileFunction jobFunction = NULL;
+static void* jobArg = NULL;
+
+static bool takeTile(int self, int* tile) {
+    // Take from the front of our own queue
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if(!queues[self].tiles.empty()) {
+            *tile = queues[self].tiles.front();
+            queues[self].tiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of someone else's
+    for(int i = 1; i < poolSize; i++) {
+        TileQueue* victim = &(queues[(self + i) % poolSize]);
+
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if(!victim->tiles.empty()) {
+            *tile = victim->tiles.back();
+            victim->tiles.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void workOnTiles(int self) {
+    int tile;
+    while(takeTile(self, &tile)) {
+        jobFunction(tile, self, jobArg);
+    }
+}
+
+static void workerLoop(int self) {
+    unsigned long seenGeneration = 0;
+
+    while(true) {
+        // Wait for a new job
+        {
+            std::unique_lock<std::mutex> guard(poolLock);
+            jobStarted.wait(guard, [&] { return stopping || jobGeneration != seenGeneration; });
+
+            if(stopping) {
+                return;
+            }
+
+            seenGeneration = jobGeneration;
+        }
+
+        workOnTiles(self);
+
+        // Report completion
+        {
+            std::lock_guard<std::mutex> guard(poolLock);
+            busyWorkers--;
+            if(busyWorkers == 0) {
+                jobFinished.notify_one();
+            }
+        }
+    }
+}
+
+void startThreadPool(int threads) {
+    if(threads < 1) {
+        threads = 1;
+    }
+
+    poolSize = threads;
+    queues = new TileQueue[poolSize];
+
+    // Thread 0 is the caller
+    for(int i = 1; i < poolSize; i++) {
+        workers.push_back(std::thread(workerLoop, i));
+    }
+}
+
+void stopThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        stopping = true;
+    }
+    jobStarted.notify_all();
+
+    for(size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    workers.clear();
+    delete[] queues;
+    queues = NULL;
+    poolSize = 1;
+    stopping = false;
+}
+
+int threadPoolSize() {
+    return poolSize;
+}
+
+void runTiles(int tileCount, TileFunction function, void* arg) {
+    // Nothing to share, run in the caller
+    if(poolSize == 1 || tileCount <= 1) {
+        for(int i = 0; i < tileCount; i++) {
+            function(i, 0, arg);
+        }
+        return;
+    }
+
+    // Deal out contiguous slices of tiles
+    for(int i = 0; i < poolSize; i++) {
+        int first = (int)(((long)tileCount * i) / poolSize);
+        int last = (int)(((long)tileCount * (i + 1)) / poolSize);
+
+        std::lock_guard<std::mutex> guard(queues[i].lock);
+        for(int tile = first; tile < last; tile++) {
+            queues[i].tiles.push_back(tile);
+        }
+    }
+
+    // Wake up the workers
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        jobFunction = function;
+        jobArg = arg;
+        busyWorkers = poolSize - 1;
+        jobGeneration++;
+    }
+    jobStarted.notify_all();
+
+    // Help out, then wait for everyone else to run dry
+    workOnTiles(0);
+
+    std::unique_lock<std::mutex> guard(poolLock);
+    jobFinished.wait(guard, [] { return busyWorkers == 0; });
+}
@@ -0,0 +1,171 @@
+// Orders the tiles of dynamic partitioning along space filling curves
+
+#include <algorithm>
+#include <utility>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "tileorder.h"
+
+// Distance along the Hilbert curve filling an n x n grid, n a power of 2
+static long long hilbertIndex(int n, int x, int y) {
+    long long index = 0;
+
+    for(int s = n / 2; s > 0; s /= 2) {
+        int rx = (x & s) > 0;
+        int ry = (y & s) > 0;
+        index += (long long) s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve inside it runs the right way
+        if(ry == 0) {
+            if(rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+
+            std::swap(x, y);
+        }
+    }
+
+    return index;
+}
+
+// Distance along the Morton (Z order) curve, bits of x and y interleaved
+static long long mortonIndex(int x, int y) {
+    long long index = 0;
+
+    for(int bit = 0; bit < 31; bit++) {
+        index |= (long long)((x >> bit) & 1) << (2 * bit);
+        index |= (long long)((y >> bit) & 1) << ((2 * bit) + 1);
+    }
+
+    return index;
+}
+
+void buildTileSequence(ConfigData* data, TileOrder order, int chunks, TileSequence* sequence) {
+    int tilesAcross = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    int tilesDown = (data->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight;
+    int totalTiles = tilesAcross * tilesDown;
+
+    // The curves are laid over the smallest power of 2 square holding
+    // every tile; the tiles outside the image are simply never visited
+    int n = 1;
+    while(n < tilesAcross || n < tilesDown) {
+        n *= 2;
+    }
+
+    std::vector<std::pair<long long, int> > keys(totalTiles);
+    for(int tile = 0; tile < totalTiles; tile++) {
+        int x = tile % tilesAcross;
+        int y = tile / tilesAcross;
+
+        long long key = tile;
+        if(order == TILE_ORDER_HILBERT) {
+            key = hilbertIndex(n, x, y);
+        } else if(order == TILE_ORDER_MORTON) {
+            key = mortonIndex(x, y);
+        }
+
+        keys[tile] = std::make_pair(key, tile);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    sequence->tiles.resize(totalTiles);
+    for(int i = 0; i < totalTiles; i++) {
+        sequence->tiles[i] = keys[i].second;
+    }
+
+    // Contiguous, nearly equal chunks along the curve
+    sequence->next.resize(chunks);
+    sequence->end.resize(chunks);
+    for(int chunk = 0; chunk < chunks; chunk++) {
+        sequence->next[chunk] = (int)(((long long) totalTiles * chunk) / chunks);
+        sequence->end[chunk] = (int)(((long long) totalTiles * (chunk + 1)) / chunks);
+    }
+
+    sequence->tilesAcross = tilesAcross;
+    sequence->raster = (order == TILE_ORDER_RASTER);
+}
+
+bool takeTiles(ConfigData* data, TileSequence* sequence, int worker, int count, int* x, int* y, int* width, int* height) {
+    int chunks = sequence->next.size();
+    int chunk = worker % chunks;
+    int across = sequence->tilesAcross;
+    bool fromBack = false;
+
+    if(sequence->next[chunk] >= sequence->end[chunk]) {
+        // Ours is empty, take from the back of the fullest one
+        int fullest = 0;
+        for(int i = 1; i < chunks; i++) {
+            if(sequence->end[i] - sequence->next[i] > sequence->end[fullest] - sequence->next[fullest]) {
+                fullest = i;
+            }
+        }
+
+        if(sequence->next[fullest] >= sequence->end[fullest]) {
+            return false;
+        }
+
+        chunk = fullest;
+        fromBack = true;
+    }
+
+    int available = sequence->end[chunk] - sequence->next[chunk];
+    if(!sequence->raster || count < 1) {
+        count = 1;
+    }
+
+    // The tile at the end we take from, and how far along its row it is
+    // from that end
+    int tile = fromBack ? sequence->tiles[sequence->end[chunk] - 1] : sequence->tiles[sequence->next[chunk]];
+    int column = tile % across;
+    int toRowEnd = fromBack ? column + 1 : across - column;
+
+    // Whole rows when starting on a row boundary, otherwise a run along
+    // the row
+    int tilesWide, tilesHigh;
+    if(toRowEnd == across && count >= across && available >= across) {
+        tilesWide = across;
+        tilesHigh = std::min(count, available) / across;
+    } else {
+        tilesWide = std::min(std::min(count, toRowEnd), available);
+        tilesHigh = 1;
+    }
+
+    int taken = tilesWide * tilesHigh;
+    if(fromBack) {
+        sequence->end[chunk] -= taken;
+        tile -= taken - 1;
+    } else {
+        sequence->next[chunk] += taken;
+    }
+
+    *x = data->dynamicBlockWidth * (tile % across);
+    *y = data->dynamicBlockHeight * (tile / across);
+    *width = std::min(data->dynamicBlockWidth * tilesWide, data->width - *x);
+    *height = std::min(data->dynamicBlockHeight * tilesHigh, data->height - *y);
+    return true;
+}
+
+int countRemainingTiles(TileSequence* sequence) {
+    int remaining = 0;
+    for(size_t chunk = 0; chunk < sequence->next.size(); chunk++) {
+        remaining += sequence->end[chunk] - sequence->next[chunk];
+    }
+
+    return remaining;
+}
+
+int getMaxPacketTiles(ConfigData* data) {
+    if(!renderOptions.guided) {
+        return 1;
+    }
+
+    // The first packet is the largest; the sizes only shrink from there
+    int tilesAcross = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    int tilesDown = (data->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight;
+    int workers = std::max(data->mpi_procs - 1, 1);
+
+    return ((tilesAcross * tilesDown) + (2 * workers) - 1) / (2 * workers);
+}
@@ -0,0 +1,114 @@
+// Tone reproduction of the image, spread over the processes that
+// rendered it
+
+#include <mpi.h>
+#include <algorithm>
+#include <math.h>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "sharedimage.h"
+#include "tonemap.h"
+
+// Middle grey that Reinhard's operator maps the log-average luminance to
+#define TONE_MAP_KEY 0.18
+
+// Added before taking the log of a luminance, so black pixels count
+#define TONE_MAP_DELTA 1.0e-4
+
+// Luminance in cd/m^2 of a pixel value of 1, and of the display's white,
+// for Ward's operator
+#define TONE_MAP_DISPLAY_LUMINANCE 100.0
+
+bool usesToneMapping(ConfigData* data) {
+    if(renderOptions.toneMap == TONE_MAP_NONE || usesSharedImage(data)) {
+        return false;
+    }
+
+    switch((int) data->partitioningMode) {
+        case PART_MODE_STATIC_STRIPS_HORIZONTAL:
+        case PART_MODE_STATIC_STRIPS_VERTICAL:
+        case PART_MODE_STATIC_CYCLES_HORIZONTAL:
+        case PART_MODE_STATIC_CYCLES_VERTICAL:
+        case PART_MODE_STATIC_BLOCKS:
+        case PART_MODE_STATIC_COST_BLOCKS:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Luminance of a pixel, with the weights Reinhard et al. use
+static double getLuminance(float* pixel) {
+    return (0.27 * pixel[0]) + (0.67 * pixel[1]) + (0.06 * pixel[2]);
+}
+
+// Luminance totals of some pixels: log sum, pixel count and maximum,
+// reduced as one element so MPI never splits them up
+static MPI_Datatype totalsType = MPI_DATATYPE_NULL;
+static MPI_Op combineOp = MPI_OP_NULL;
+
+// Combines luminance totals, each element a log sum, pixel count and
+// maximum
+static void combineLuminance(void* in, void* inout, int* length, MPI_Datatype* type) {
+    (void) type;
+    double* a = (double*) in;
+    double* b = (double*) inout;
+
+    for(int i = 0; i < 3 * (*length); i += 3) {
+        b[i] += a[i];
+        b[i + 1] += a[i + 1];
+        b[i + 2] = std::max(b[i + 2], a[i + 2]);
+    }
+}
+
+void toneMapPixels(float* pixels, int channels, unsigned char* quantized) {
+    // Our part of the image's luminance
+    double totals[3] = { 0.0, 0.0, 0.0 };
+    for(int i = 0; i < channels; i += 3) {
+        double luminance = getLuminance(&(pixels[i]));
+        totals[0] += log(TONE_MAP_DELTA + luminance);
+        totals[1] += 1.0;
+        totals[2] = std::max(totals[2], luminance);
+    }
+
+    // The whole image's, in one reduction. The type and op are kept for
+    // the rest of the run; MPI frees them at MPI_Finalize().
+    if(combineOp == MPI_OP_NULL) {
+        MPI_Type_contiguous(3, MPI_DOUBLE, &totalsType);
+        MPI_Type_commit(&totalsType);
+        MPI_Op_create(combineLuminance, 1, &combineOp);
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, totals, 1, totalsType, combineOp, MPI_COMM_WORLD);
+
+    double averageLuminance = totals[1] > 0.0 ? exp(totals[0] / totals[1]) : 1.0;
+    double maxLuminance = totals[2];
+
+    // Ward's operator scales every pixel alike
+    double wardScale = pow((1.219 + pow(TONE_MAP_DISPLAY_LUMINANCE / 2.0, 0.4))
+        / (1.219 + pow(averageLuminance * TONE_MAP_DISPLAY_LUMINANCE, 0.4)), 2.5);
+
+    // Reinhard's maps the brightest pixel of the image to white
+    double keyScale = TONE_MAP_KEY / averageLuminance;
+    double white = keyScale * maxLuminance;
+
+    for(int i = 0; i < channels; i += 3) {
+        double scale = wardScale;
+
+        if(renderOptions.toneMap == TONE_MAP_REINHARD) {
+            double luminance = getLuminance(&(pixels[i]));
+            scale = 0.0;
+            if(luminance > 0.0 && white > 0.0) {
+                double scaled = keyScale * luminance;
+                double display = (scaled * (1.0 + (scaled / (white * white)))) / (1.0 + scaled);
+                scale = display / luminance;
+            }
+        }
+
+        for(int c = 0; c < 3; c++) {
+            quantized[i + c] = quantizeChannel((float) (pixels[i + c] * scale));
+        }
+    }
+}
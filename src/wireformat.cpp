@@ -0,0 +1,157 @@
+// Compact formats for sending rendered pixels between processes
+
+#include <mpi.h>
+#include <cstddef>
+#include <cstring>
+
+#include "common.h"
+#include "wireformat.h"
+
+MPI_Datatype createTileHeaderType() {
+    int lengths[2] = { 4, 2 };
+    MPI_Aint displacements[2] = { offsetof(TileHeader, x), offsetof(TileHeader, computationTime) };
+    MPI_Datatype types[2] = { MPI_INT32_T, MPI_DOUBLE };
+
+    MPI_Datatype headerType;
+    MPI_Type_create_struct(2, lengths, displacements, types, &headerType);
+    MPI_Type_commit(&headerType);
+    return headerType;
+}
+
+MPI_Datatype createTileMessageType(MPI_Datatype headerType, TileHeader* header, MPI_Datatype pixelsType, void* pixels) {
+    int lengths[2] = { 1, 1 };
+    MPI_Aint displacements[2];
+    MPI_Get_address(header, &(displacements[0]));
+    MPI_Get_address(pixels, &(displacements[1]));
+    MPI_Datatype types[2] = { headerType, pixelsType };
+
+    MPI_Datatype messageType;
+    MPI_Type_create_struct(2, lengths, displacements, types, &messageType);
+    MPI_Type_commit(&messageType);
+    return messageType;
+}
+
+MPI_Datatype wireChannelType(WireFormat format) {
+    switch(format) {
+        case WIRE_FORMAT_HALF:
+            return MPI_UINT16_T;
+        case WIRE_FORMAT_BYTE:
+            return MPI_UNSIGNED_CHAR;
+        default:
+            return MPI_FLOAT;
+    }
+}
+
+int wireChannelSize(WireFormat format) {
+    switch(format) {
+        case WIRE_FORMAT_HALF:
+            return sizeof(uint16_t);
+        case WIRE_FORMAT_BYTE:
+            return sizeof(unsigned char);
+        default:
+            return sizeof(float);
+    }
+}
+
+// Rounds a float to the nearest half float, ties to even
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Infinity and NaN
+    if(((bits >> 23) & 0xff) == 0xff) {
+        return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+    }
+
+    // Too large
+    if(exponent >= 31) {
+        return sign | 0x7c00;
+    }
+
+    // Too small for a normal half, shift the implicit 1 into the mantissa
+    int shift = 13;
+    uint32_t half;
+    if(exponent <= 0) {
+        if(exponent < -10) {
+            return sign;
+        }
+
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+    } else {
+        half = ((uint32_t) exponent << 10) | (mantissa >> shift);
+    }
+
+    // A carry out of the mantissa correctly rounds up to the next exponent
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (half & 1))) {
+        half++;
+    }
+
+    return sign | half;
+}
+
+static float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+
+    if(exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if(exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if(mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal, normalize it
+        exponent = 113;
+        while(!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void encodePixels(WireFormat format, float* pixels, int channels, void* wire) {
+    if(format == WIRE_FORMAT_HALF) {
+        uint16_t* halves = (uint16_t*) wire;
+        for(int i = 0; i < channels; i++) {
+            halves[i] = floatToHalf(pixels[i]);
+        }
+    } else if(format == WIRE_FORMAT_BYTE) {
+        unsigned char* bytes = (unsigned char*) wire;
+        for(int i = 0; i < channels; i++) {
+            bytes[i] = quantizeChannel(pixels[i]);
+        }
+    } else {
+        memcpy(wire, pixels, channels * sizeof(float));
+    }
+}
+
+void decodePixels(WireFormat format, void* wire, int channels, float* pixels) {
+    if(format == WIRE_FORMAT_HALF) {
+        uint16_t* halves = (uint16_t*) wire;
+        for(int i = 0; i < channels; i++) {
+            pixels[i] = halfToFloat(halves[i]);
+        }
+    } else if(format == WIRE_FORMAT_BYTE) {
+        unsigned char* bytes = (unsigned char*) wire;
+        for(int i = 0; i < channels; i++) {
+            pixels[i] = (bytes[i] + 0.5f) / 255.0f;
+        }
+    } else {
+        memcpy(pixels, wire, channels * sizeof(float));
+    }
+}
@@ -0,0 +1,291 @@
+// Distributed work stealing shared by the master and slave processes
+
+#include <mpi.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "RayTrace.h"
+#include "common.h"
+#include "workstealing.h"
+#include "tileorder.h"
+
+// Message tags used while stealing. Results are gathered with tag 0
+// afterwards, as in the other modes.
+#define TAG_STEAL_REQUEST 1
+#define TAG_STEAL_REPLY 2
+#define TAG_PROGRESS 3
+#define TAG_DONE 4
+
+// Pause between polls while waiting on other processes, in microseconds
+#define IDLE_POLL_PAUSE 20
+
+// Wait before the next steal after an empty reply, in microseconds. It
+// doubles with every empty reply in a row, so idle processes stop
+// flooding the few that still have work near the end.
+#define STEAL_BACKOFF_MIN 50
+#define STEAL_BACKOFF_MAX 5000
+
+// Tiles not yet started by this process, [next, end) of the tile order
+typedef struct {
+    int next;
+    int end;
+} TileRange;
+
+void getStolenTileBounds(ConfigData* data, int tile, int* x, int* y, int* width, int* height) {
+    int tilesAcross = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+
+    *x = data->dynamicBlockWidth * (tile % tilesAcross);
+    *y = data->dynamicBlockHeight * (tile / tilesAcross);
+
+    // Don't render out of bounds
+    *width = data->dynamicBlockWidth;
+    if(*x + *width > data->width) {
+        *width = data->width - *x;
+    }
+
+    *height = data->dynamicBlockHeight;
+    if(*y + *height > data->height) {
+        *height = data->height - *y;
+    }
+}
+
+// Gives up the core for a moment while there is nothing to do but poll
+static void idlePause() {
+    std::this_thread::sleep_for(std::chrono::microseconds(IDLE_POLL_PAUSE));
+}
+
+// Answers every pending steal request with half of our remaining tiles
+static void answerStealRequests(TileRange* range) {
+    int flag, request;
+    MPI_Status status;
+
+    MPI_Iprobe(MPI_ANY_SOURCE, TAG_STEAL_REQUEST, MPI_COMM_WORLD, &flag, &status);
+    while(flag) {
+        MPI_Recv(&request, 1, MPI_INT, status.MPI_SOURCE, TAG_STEAL_REQUEST, MPI_COMM_WORLD, &status);
+
+        // Give away the back half, keep the front
+        int give = (range->end - range->next) / 2;
+        int reply[2];
+        reply[0] = range->end - give;
+        reply[1] = range->end;
+        range->end -= give;
+
+        MPI_Send(reply, 2, MPI_INT, status.MPI_SOURCE, TAG_STEAL_REPLY, MPI_COMM_WORLD);
+
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_STEAL_REQUEST, MPI_COMM_WORLD, &flag, &status);
+    }
+}
+
+// Rank 0 - collects progress reports, returns true once every tile is done
+static bool collectProgress(ConfigData* data, int* completedByRank, int totalTiles) {
+    int flag;
+    MPI_Status status;
+
+    MPI_Iprobe(MPI_ANY_SOURCE, TAG_PROGRESS, MPI_COMM_WORLD, &flag, &status);
+    while(flag) {
+        MPI_Recv(&(completedByRank[status.MPI_SOURCE]), 1, MPI_INT, status.MPI_SOURCE, TAG_PROGRESS, MPI_COMM_WORLD, &status);
+        MPI_Iprobe(MPI_ANY_SOURCE, TAG_PROGRESS, MPI_COMM_WORLD, &flag, &status);
+    }
+
+    int completed = 0;
+    for(int i = 0; i < data->mpi_procs; i++) {
+        completed += completedByRank[i];
+    }
+
+    if(completed < totalTiles) {
+        return false;
+    }
+
+    // Everything is done, tell everyone else
+    int done = 1;
+    for(int i = 1; i < data->mpi_procs; i++) {
+        MPI_Send(&done, 1, MPI_INT, i, TAG_DONE, MPI_COMM_WORLD);
+    }
+
+    return true;
+}
+
+// Other ranks - checks for the done message from rank 0
+static bool checkDone() {
+    int flag, done;
+    MPI_Status status;
+
+    MPI_Iprobe(0, TAG_DONE, MPI_COMM_WORLD, &flag, &status);
+    if(flag) {
+        MPI_Recv(&done, 1, MPI_INT, 0, TAG_DONE, MPI_COMM_WORLD, &status);
+    }
+
+    return flag;
+}
+
+void renderWithWorkStealing(ConfigData* data, float* image, StolenTiles* results) {
+    int tilesAcross = (data->width + data->dynamicBlockWidth - 1) / data->dynamicBlockWidth;
+    int tilesDown = (data->height + data->dynamicBlockHeight - 1) / data->dynamicBlockHeight;
+    int totalTiles = tilesAcross * tilesDown;
+
+    // Slices are taken along the -to order, so they hold nearby tiles
+    TileSequence sequence;
+    buildTileSequence(data, renderOptions.tileOrder, 1, &sequence);
+
+    /*
+     * 1.   Start with a contiguous slice of the tiles
+     * 2.   Between tiles, answer steal requests with the back half of
+     *      what is left
+     * 3.   When out of tiles, report the number of tiles done to rank 0
+     *      and ask a random process for more. After an empty reply, wait
+     *      a growing backoff before asking again.
+     * 4.   Continue from 2. until rank 0 has counted every tile and says
+     *      we're done
+     * 5.   Keep answering steal requests until everyone is done, so that
+     *      no request is left unanswered
+     */
+
+    TileRange range;
+    range.next = (int)(((long)totalTiles * data->mpi_rank) / data->mpi_procs);
+    range.end = (int)(((long)totalTiles * (data->mpi_rank + 1)) / data->mpi_procs);
+
+    int completed = 0;
+    int reported = 0;
+    int* completedByRank = NULL;
+    if(data->mpi_rank == 0) {
+        completedByRank = new int[data->mpi_procs]();
+    }
+
+    unsigned int seed = 1 + data->mpi_rank;
+    int victim = -1;
+    int request = 0;
+    int reply[2];
+    MPI_Request replyRequest;
+    MPI_Status status;
+    int flag;
+
+    int backoff = STEAL_BACKOFF_MIN;
+    double nextSteal = 0.0;
+
+    results->computationTime = 0.0;
+    bool done = false;
+
+    while(!done) {
+        answerStealRequests(&range);
+
+        // Are we done
+        if(data->mpi_rank == 0) {
+            completedByRank[0] = completed;
+            done = collectProgress(data, completedByRank, totalTiles);
+        } else {
+            done = checkDone();
+        }
+
+        if(done) {
+            break;
+        }
+
+        // Render a tile of our own
+        if(range.next < range.end) {
+            double comp_start = MPI_Wtime();
+            int tile = sequence.tiles[range.next++];
+
+            RenderRegion region;
+            getStolenTileBounds(data, tile, &region.xInImage, &region.yInImage, &region.width, &region.height);
+
+            if(image != NULL) {
+                // Straight into the image
+                region.xInPixels = region.xInImage;
+                region.yInPixels = region.yInImage;
+                region.pixelsWidth = data->width;
+                region.pixelsHeight = data->height;
+                region.pixels = image;
+            } else {
+                // Packed onto the end of our results
+                int offset = results->pixels.size();
+                results->tiles.push_back(tile);
+                results->pixels.resize(offset + (3 * region.width * region.height));
+
+                region.xInPixels = 0;
+                region.yInPixels = 0;
+                region.pixelsWidth = region.width;
+                region.pixelsHeight = region.height;
+                region.pixels = &(results->pixels[offset]);
+            }
+
+            renderRegion(data, &region);
+            completed++;
+
+            results->computationTime += MPI_Wtime() - comp_start;
+            continue;
+        }
+
+        // Out of tiles. Let rank 0 know how far we got
+        if(data->mpi_rank != 0 && completed != reported) {
+            MPI_Send(&completed, 1, MPI_INT, 0, TAG_PROGRESS, MPI_COMM_WORLD);
+            reported = completed;
+        }
+
+        if(data->mpi_procs == 1) {
+            continue;
+        }
+
+        if(victim == -1) {
+            if(MPI_Wtime() < nextSteal) {
+                // Backing off after an empty reply
+                idlePause();
+                continue;
+            }
+
+            // Pick someone other than us to steal from
+            victim = rand_r(&seed) % (data->mpi_procs - 1);
+            if(victim >= data->mpi_rank) {
+                victim++;
+            }
+
+            MPI_Irecv(reply, 2, MPI_INT, victim, TAG_STEAL_REPLY, MPI_COMM_WORLD, &replyRequest);
+            MPI_Send(&request, 1, MPI_INT, victim, TAG_STEAL_REQUEST, MPI_COMM_WORLD);
+        } else {
+            MPI_Test(&replyRequest, &flag, &status);
+            if(flag) {
+                // Empty if the victim had nothing to spare
+                range.next = reply[0];
+                range.end = reply[1];
+                victim = -1;
+
+                if(range.next < range.end) {
+                    backoff = STEAL_BACKOFF_MIN;
+                } else {
+                    nextSteal = MPI_Wtime() + (backoff * 1.0e-6);
+                    backoff = std::min(2 * backoff, STEAL_BACKOFF_MAX);
+                }
+            } else {
+                idlePause();
+            }
+        }
+    }
+
+    // Wait out our last steal; the victim answers until everyone is done
+    while(victim != -1) {
+        answerStealRequests(&range);
+
+        MPI_Test(&replyRequest, &flag, &status);
+        if(flag) {
+            victim = -1;
+        } else {
+            idlePause();
+        }
+    }
+
+    // Everyone answers steal requests until every process got here
+    MPI_Request barrierRequest;
+    MPI_Ibarrier(MPI_COMM_WORLD, &barrierRequest);
+
+    flag = 0;
+    while(!flag) {
+        answerStealRequests(&range);
+        MPI_Test(&barrierRequest, &flag, &status);
+        if(!flag) {
+            idlePause();
+        }
+    }
+
+    delete[] completedByRank;
+}